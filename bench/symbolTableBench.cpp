@@ -0,0 +1,41 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include "../src/symbolTable.hpp"
+
+// Declares and looks up 10k, 100k and 1M symbols in one scope, then shadows
+// them all in a nested scope and exits it. Every operation is O(1), so the
+// time per declaration should stay flat as the count grows.
+int main()
+{
+  for (uint32_t count : {10'000u, 100'000u, 1'000'000u})
+  {
+    const auto start = std::chrono::steady_clock::now();
+    ScopedSymbolTable<uint64_t> table;
+    uint64_t sum = 0;
+    table.enter_scope();
+    for (SymbolId symbol = 0; symbol < count; symbol++)
+    {
+      if (table.declared_in_current_scope(symbol))
+      {
+        std::cerr << "symbol " << symbol << " declared twice\n";
+        return EXIT_FAILURE;
+      }
+      table.declare(symbol, symbol);
+      sum += *table.lookup(symbol / 2);
+    }
+    table.enter_scope();
+    for (SymbolId symbol = 0; symbol < count; symbol++)
+    {
+      table.declare(symbol, symbol);
+    }
+    table.exit_scope();
+    table.exit_scope();
+    const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << count << " declarations: " << elapsed.count() << " ms, "
+              << elapsed.count() * 1e6 / count << " ns each (checksum " << sum << ")\n";
+  }
+  return EXIT_SUCCESS;
+}
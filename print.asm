@@ -1,7 +1,8 @@
 ; ============================================
 ; print_int: prints signed integer + newline
 ; arg: RDI = integer
-; clobbers: RAX, RBX, RCX, RDX, RSI, R8, R9
+; clobbers: RAX, RDI (all other registers are preserved,
+; so generated code can keep values in them across calls)
 ; ============================================
 global print_int
 global print_string
@@ -9,6 +10,13 @@ global print_char
 section .text
 ; -------------------------------
 print_int:
+    push    rbx
+    push    rcx
+    push    rdx
+    push    rsi
+    push    r8
+    push    r9
+    push    r11                 ; rcx and r11 are clobbered by syscall
     push    rbp
     mov     rbp, rsp
     sub     rsp, 64             ; scratch buffer on stack
@@ -63,6 +71,13 @@ print_int:
     mov     rdx, rcx            ; len
     syscall
     leave
+    pop     r11
+    pop     r9
+    pop     r8
+    pop     rsi
+    pop     rdx
+    pop     rcx
+    pop     rbx
     ret
 ; -------------------------------
 ; print_string: prints null-terminated string + newline
@@ -99,9 +114,13 @@ print_string:
 ; -------------------------------
 ; print_char: prints single character + newline
 ; arg: RDI = character (in lower 8 bits)
-; clobbers: RAX, RDX, RSI
+; clobbers: RAX, RDI (all other registers are preserved)
 ; ============================================
 print_char:
+    push    rcx
+    push    rdx
+    push    rsi
+    push    r11
     push    rbp
     mov     rbp, rsp
     ; store character and newline on stack
@@ -116,4 +135,8 @@ print_char:
     syscall
     add     rsp, 2
     leave
+    pop     r11
+    pop     rsi
+    pop     rdx
+    pop     rcx
     ret
\ No newline at end of file
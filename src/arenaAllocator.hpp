@@ -1,29 +1,166 @@
 #pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
-class ArenaAllocator{
-  public:
-    inline explicit ArenaAllocator(size_t bytes):m_size(bytes){
-      m_buffer = static_cast<std::byte*>(malloc(m_size));
-      m_offset = m_buffer;
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bump allocator that grows in geometrically sized blocks. Allocations honour
+// the requested alignment, and objects created with emplace() that are not
+// trivially destructible have their destructors run, in reverse order of
+// construction, when the arena is destroyed.
+//
+// The arena is also a std::pmr::memory_resource, so std::pmr containers
+// (e.g. AST child lists) can take their storage from it. Deallocation is a
+// no-op; everything is released together with the arena.
+class ArenaAllocator : public std::pmr::memory_resource
+{
+public:
+  struct Stats
+  {
+    size_t bytes_used = 0;     // handed out to callers, including padding
+    size_t bytes_wasted = 0;   // alignment padding plus unused block tails
+    size_t bytes_reserved = 0; // total size of all blocks
+    size_t blocks = 0;
+
+    Stats &operator+=(const Stats &other)
+    {
+      bytes_used += other.bytes_used;
+      bytes_wasted += other.bytes_wasted;
+      bytes_reserved += other.bytes_reserved;
+      blocks += other.blocks;
+      return *this;
     }
+  };
+
+  static constexpr size_t default_block_size = 64 * 1024;
+  static constexpr size_t max_block_size = 64 * 1024 * 1024;
+
+  inline explicit ArenaAllocator(size_t first_block_size = default_block_size)
+      : m_next_block_size(std::max<size_t>(first_block_size, 256)) {}
+
+  inline ArenaAllocator(const ArenaAllocator &other) = delete;
 
-    template<typename T>
-    inline T* alloc(){
-      void* offset = m_offset;
-      m_offset += sizeof(T);
-      return static_cast<T*>(offset);
+  inline ArenaAllocator &operator=(const ArenaAllocator &other) = delete;
+
+  inline ~ArenaAllocator() override
+  {
+    for (Finalizer *f = m_finalizers; f != nullptr; f = f->next)
+    {
+      f->destroy(f->object);
+    }
+    while (m_block != nullptr)
+    {
+      Block *prev = m_block->prev;
+      free(m_block);
+      m_block = prev;
     }
+  }
 
-    inline ArenaAllocator(const ArenaAllocator& other) = delete;
-   
-    inline ArenaAllocator& operator=(const ArenaAllocator& other) = delete;
+  inline void *allocate(size_t bytes, size_t align = alignof(std::max_align_t))
+  {
+    std::byte *aligned = align_up(m_offset, align);
+    if (m_block == nullptr || aligned + bytes > m_end)
+    {
+      grow(bytes + align);
+      aligned = align_up(m_offset, align);
+    }
+    m_stats.bytes_used += (aligned - m_offset) + bytes;
+    m_stats.bytes_wasted += aligned - m_offset;
+    m_offset = aligned + bytes;
+    return aligned;
+  }
 
-    inline ~ArenaAllocator(){
-      free(m_buffer);
+  // Constructs a T in the arena. Destructors of non-trivially destructible
+  // types are registered and run when the arena is destroyed.
+  template <typename T, typename... Args>
+  inline T *emplace(Args &&...args)
+  {
+    void *memory = allocate(sizeof(T), alignof(T));
+    T *object = new (memory) T(std::forward<Args>(args)...);
+    if constexpr (!std::is_trivially_destructible_v<T>)
+    {
+      void *slot = allocate(sizeof(Finalizer), alignof(Finalizer));
+      m_finalizers = new (slot) Finalizer{[](void *p)
+                                          { static_cast<T *>(p)->~T(); },
+                                          object, m_finalizers};
     }
-    
-  private:
-    size_t m_size;
-    std::byte* m_buffer;
-    std::byte* m_offset;
+    return object;
+  }
+
+  // The unused tail of the current block is still available, so it is not
+  // counted as wasted.
+  inline Stats stats() const
+  {
+    return m_stats;
+  }
+
+protected:
+  inline void *do_allocate(size_t bytes, size_t align) override
+  {
+    return allocate(bytes, align);
+  }
+
+  inline void do_deallocate(void *, size_t, size_t) override
+  {
+  }
+
+  inline bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+  {
+    return this == &other;
+  }
+
+private:
+  struct Block
+  {
+    Block *prev;
+    size_t size;
+  };
+
+  struct Finalizer
+  {
+    void (*destroy)(void *);
+    void *object;
+    Finalizer *next;
+  };
+
+  static inline std::byte *align_up(std::byte *p, size_t align)
+  {
+    auto addr = reinterpret_cast<uintptr_t>(p);
+    return reinterpret_cast<std::byte *>((addr + align - 1) & ~(uintptr_t)(align - 1));
+  }
+
+  inline void grow(size_t min_bytes)
+  {
+    size_t size = std::max(m_next_block_size, min_bytes + sizeof(Block));
+    auto *block = static_cast<Block *>(malloc(size));
+    if (block == nullptr)
+    {
+      std::cerr << "Out of memory\n";
+      std::exit(EXIT_FAILURE);
+    }
+    if (m_block != nullptr)
+    {
+      m_stats.bytes_wasted += m_end - m_offset;
+    }
+    block->prev = m_block;
+    block->size = size;
+    m_block = block;
+    m_offset = reinterpret_cast<std::byte *>(block + 1);
+    m_end = reinterpret_cast<std::byte *>(block) + size;
+    m_next_block_size = std::min(m_next_block_size * 2, max_block_size);
+    m_stats.bytes_reserved += size;
+    m_stats.blocks++;
+  }
+
+  Block *m_block = nullptr;
+  std::byte *m_offset = nullptr;
+  std::byte *m_end = nullptr;
+  size_t m_next_block_size;
+  Finalizer *m_finalizers = nullptr;
+  Stats m_stats;
 };
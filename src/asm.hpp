@@ -0,0 +1,297 @@
+#pragma once
+#include <cstdint>
+#include <iterator>
+#include <ostream>
+#include <vector>
+#include "./regAlloc.hpp"
+
+// The generator's output as a list of instructions rather than text, so the
+// peephole optimiser can inspect and rewrite it. Only the instructions and
+// operand forms the generator uses are represented.
+
+enum class Mnemonic : uint8_t
+{
+  Label, // dst is the Label
+  Mov,
+  Movzx,
+  Lea,
+  Add,
+  Sub,
+  Imul, // with no src: rdx:rax = rax * dst
+  Neg,
+  And,
+  Or,
+  Shl,
+  Sar,
+  Shr,
+  Test,
+  Cmp,
+  Sete,
+  Setne,
+  Setl,
+  Setg,
+  Setle,
+  Setge,
+  Cqo,
+  Idiv,
+  Jmp,
+  Jz,
+  Jnz,
+  Je,
+  Jne,
+  Jl,
+  Jg,
+  Jle,
+  Jge,
+  Jo,
+  Call,
+  Push,
+  Pop,
+  Syscall,
+};
+
+// Indexed by Mnemonic.
+inline constexpr const char *mnemonic_names[] = {
+    "", "mov", "movzx", "lea", "add", "sub", "imul", "neg", "and", "or", "shl", "sar", "shr", "test", "cmp",
+    "sete", "setne", "setl", "setg", "setle", "setge", "cqo", "idiv", "jmp", "jz", "jnz", "je", "jne", "jl",
+    "jg", "jle", "jge", "jo", "call", "push", "pop", "syscall",
+};
+static_assert(std::size(mnemonic_names) == static_cast<size_t>(Mnemonic::Syscall) + 1);
+
+struct AsmOperand
+{
+  enum class Kind : uint8_t
+  {
+    None,
+    Reg,     // a 64-bit register, value is a Reg
+    Byte,    // al (value 0) or ah (value 1)
+    Imm,     // value
+    Slot,    // QWORD [rsp + value]
+    ByteMem, // byte [rsp + value]
+    Addr,    // [rsp + value], for lea
+    Label,   // the label of block `value`
+    Symbol,  // an extern routine
+  };
+
+  Kind kind = Kind::None;
+  int64_t value = 0;
+  const char *symbol = nullptr;
+
+  static AsmOperand reg(Reg reg)
+  {
+    return {Kind::Reg, static_cast<int64_t>(reg)};
+  }
+
+  bool is_reg(Reg reg) const
+  {
+    return kind == Kind::Reg && value == static_cast<int64_t>(reg);
+  }
+
+  bool is_memory() const
+  {
+    return kind == Kind::Slot || kind == Kind::ByteMem;
+  }
+
+  bool operator==(const AsmOperand &other) const
+  {
+    return kind == other.kind && value == other.value && symbol == other.symbol;
+  }
+
+  friend std::ostream &operator<<(std::ostream &out, const AsmOperand &operand)
+  {
+    switch (operand.kind)
+    {
+    case Kind::None:
+      break;
+    case Kind::Reg:
+      out << reg_names[operand.value];
+      break;
+    case Kind::Byte:
+      out << (operand.value == 0 ? "al" : "ah");
+      break;
+    case Kind::Imm:
+      out << operand.value;
+      break;
+    case Kind::Slot:
+      out << "QWORD [rsp + " << operand.value << "]";
+      break;
+    case Kind::ByteMem:
+      out << "byte " << AsmOperand{Kind::Addr, operand.value};
+      break;
+    case Kind::Addr:
+      out << "[rsp" << (operand.value < 0 ? "" : "+") << operand.value << "]";
+      break;
+    case Kind::Label:
+      out << "label" << operand.value;
+      break;
+    case Kind::Symbol:
+      out << operand.symbol;
+      break;
+    }
+    return out;
+  }
+};
+
+struct AsmInst
+{
+  Mnemonic op;
+  AsmOperand dst;
+  AsmOperand src;
+  // For jumps to labels: the registers holding values that are still
+  // needed at the target (see RegAlloc::live_across()).
+  uint32_t live = 0;
+
+  friend std::ostream &operator<<(std::ostream &out, const AsmInst &inst)
+  {
+    if (inst.op == Mnemonic::Label)
+      return out << inst.dst << ":\n";
+    out << "    " << mnemonic_names[static_cast<size_t>(inst.op)];
+    if (inst.dst.kind != AsmOperand::Kind::None)
+    {
+      out << " " << inst.dst;
+    }
+    if (inst.src.kind != AsmOperand::Kind::None)
+    {
+      out << ", " << inst.src;
+    }
+    return out << "\n";
+  }
+};
+
+// Register sets as bit masks, by Reg, with one more bit for the flags.
+inline constexpr uint32_t flags_bit = 1u << std::size(reg_names);
+inline constexpr uint32_t all_regs = flags_bit - 1;
+
+inline constexpr uint32_t reg_bit(Reg reg)
+{
+  return 1u << static_cast<unsigned>(reg);
+}
+
+// The registers an operand reads when it is read as a value.
+inline uint32_t operand_regs(const AsmOperand &operand)
+{
+  if (operand.kind == AsmOperand::Kind::Reg)
+    return 1u << operand.value;
+  if (operand.kind == AsmOperand::Kind::Byte)
+    return reg_bit(Reg::rax);
+  return 0;
+}
+
+inline bool is_conditional_jump(Mnemonic op)
+{
+  return op >= Mnemonic::Jz && op <= Mnemonic::Jo;
+}
+
+// Whether control may continue at a label elsewhere. The error handlers
+// behind jo and je never return and read no registers, so jumps to them
+// do not count.
+inline bool is_jump_to_label(const AsmInst &inst)
+{
+  return (inst.op == Mnemonic::Jmp || is_conditional_jump(inst.op)) && inst.dst.kind == AsmOperand::Kind::Label;
+}
+
+// The registers and flags the instruction reads. Writes to al, ah and
+// other partial registers also count as reads, since the rest of the
+// register survives.
+inline uint32_t reads(const AsmInst &inst)
+{
+  switch (inst.op)
+  {
+  case Mnemonic::Mov:
+  case Mnemonic::Movzx:
+    return operand_regs(inst.src) | (inst.dst.kind == AsmOperand::Kind::Byte ? reg_bit(Reg::rax) : 0);
+  case Mnemonic::Imul:
+    if (inst.src.kind == AsmOperand::Kind::None)
+      return reg_bit(Reg::rax) | operand_regs(inst.dst);
+    return operand_regs(inst.dst) | operand_regs(inst.src);
+  case Mnemonic::Add:
+  case Mnemonic::Sub:
+  case Mnemonic::And:
+  case Mnemonic::Or:
+  case Mnemonic::Test:
+  case Mnemonic::Cmp:
+    return operand_regs(inst.dst) | operand_regs(inst.src);
+  case Mnemonic::Neg:
+  case Mnemonic::Shl:
+  case Mnemonic::Sar:
+  case Mnemonic::Shr:
+  case Mnemonic::Push:
+    return operand_regs(inst.dst);
+  case Mnemonic::Sete:
+  case Mnemonic::Setne:
+  case Mnemonic::Setl:
+  case Mnemonic::Setg:
+  case Mnemonic::Setle:
+  case Mnemonic::Setge:
+    return flags_bit | reg_bit(Reg::rax);
+  case Mnemonic::Cqo:
+    return reg_bit(Reg::rax);
+  case Mnemonic::Idiv:
+    return reg_bit(Reg::rax) | reg_bit(Reg::rdx) | operand_regs(inst.dst);
+  case Mnemonic::Call:
+    return reg_bit(Reg::rdi);
+  case Mnemonic::Syscall:
+    return reg_bit(Reg::rax) | reg_bit(Reg::rdi) | reg_bit(Reg::rsi) | reg_bit(Reg::rdx);
+  default:
+    return is_conditional_jump(inst.op) ? flags_bit : 0;
+  }
+}
+
+// The registers and flags the instruction overwrites.
+inline uint32_t writes(const AsmInst &inst)
+{
+  switch (inst.op)
+  {
+  case Mnemonic::Mov:
+  case Mnemonic::Movzx:
+  case Mnemonic::Lea:
+  case Mnemonic::Pop:
+    return operand_regs(inst.dst);
+  case Mnemonic::Imul:
+    if (inst.src.kind == AsmOperand::Kind::None)
+      return reg_bit(Reg::rax) | reg_bit(Reg::rdx) | flags_bit;
+    return operand_regs(inst.dst) | flags_bit;
+  case Mnemonic::Add:
+  case Mnemonic::Sub:
+  case Mnemonic::And:
+  case Mnemonic::Or:
+  case Mnemonic::Neg:
+  case Mnemonic::Shl:
+  case Mnemonic::Sar:
+  case Mnemonic::Shr:
+    return operand_regs(inst.dst) | flags_bit;
+  case Mnemonic::Test:
+  case Mnemonic::Cmp:
+    return flags_bit;
+  case Mnemonic::Sete:
+  case Mnemonic::Setne:
+  case Mnemonic::Setl:
+  case Mnemonic::Setg:
+  case Mnemonic::Setle:
+  case Mnemonic::Setge:
+    return reg_bit(Reg::rax);
+  case Mnemonic::Cqo:
+    return reg_bit(Reg::rdx);
+  case Mnemonic::Idiv:
+    return reg_bit(Reg::rax) | reg_bit(Reg::rdx) | flags_bit;
+  case Mnemonic::Call:
+    // The print routines preserve everything but rax and rdi.
+    return reg_bit(Reg::rax) | reg_bit(Reg::rdi) | flags_bit;
+  case Mnemonic::Syscall:
+    return reg_bit(Reg::rax) | reg_bit(Reg::rcx) | reg_bit(Reg::r11);
+  default:
+    return 0;
+  }
+}
+
+// The registers and flags live before the instruction, given those live
+// after it. A jump adds whatever its target needs; after a jmp nothing
+// runs.
+inline uint32_t live_before(const AsmInst &inst, uint32_t live_after)
+{
+  if (inst.op == Mnemonic::Jmp)
+    return inst.live;
+  if (is_jump_to_label(inst))
+    return inst.live | live_after | reads(inst);
+  return (live_after & ~writes(inst)) | reads(inst);
+}
@@ -0,0 +1,379 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "./flatAst.hpp"
+#include "./interner.hpp"
+
+// On-disk cache of a parsed program, stored next to the source as
+// "<source>.astc".
+//
+// The file is a fixed header followed by the FlatAst columns and the
+// interned identifier names. Each section is 8-byte aligned at an offset
+// recorded in the header. Everything inside refers to other data by node
+// index, symbol id or file offset, so the file is position independent:
+// load() maps it and points a FlatAst straight at the mapped columns,
+// without copying or patching anything. Only the names are interned again,
+// in id order, so symbol ids stay the same.
+//
+// A cache is only used when its version, byte order, and the size and
+// content hash of the source all match, the hash of its own contents is
+// intact, and its node references pass a bounds check. Bump `version`
+// whenever the layout or the numbering of ExprKind, StmtKind or DataType
+// changes.
+class AstCache
+{
+public:
+  static constexpr uint32_t version = 1;
+
+  static std::string path_for(std::string_view source_path)
+  {
+    return std::string(source_path) + ".astc";
+  }
+
+  static uint64_t hash_bytes(std::string_view src)
+  {
+    constexpr uint64_t k1 = 0x87c37b91114253d5ULL;
+    constexpr uint64_t k2 = 0x4cf5ad432745937fULL;
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ src.size();
+    size_t i = 0;
+    for (; i + 8 <= src.size(); i += 8)
+    {
+      uint64_t word;
+      std::memcpy(&word, src.data() + i, 8);
+      h = std::rotl(h ^ (word * k1), 31) * k2;
+    }
+    if (i < src.size())
+    {
+      uint64_t word = 0;
+      std::memcpy(&word, src.data() + i, src.size() - i);
+      h = std::rotl(h ^ (word * k1), 31) * k2;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  // Maps the cache for `src`, filling the empty `interner` with its names.
+  // Returns nothing if there is no usable cache.
+  static std::optional<FlatAst> load(const std::string &path, std::string_view src, Interner &interner)
+  {
+    if (interner.size() != 0)
+    {
+      return std::nullopt;
+    }
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      return std::nullopt;
+    }
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header))
+    {
+      ::close(fd);
+      return std::nullopt;
+    }
+    void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED)
+    {
+      return std::nullopt;
+    }
+    auto mapping = std::make_shared<Mapping>(data, static_cast<size_t>(st.st_size));
+
+    const auto *base = static_cast<const std::byte *>(data);
+    const auto *header = reinterpret_cast<const Header *>(base);
+    if (std::memcmp(header->magic, magic, sizeof(magic)) != 0 || header->version != version ||
+        header->byte_order != byte_order || header->file_size != mapping->size ||
+        header->source_size != src.size() || header->source_hash != hash_bytes(src) ||
+        header->name_count >= UINT32_MAX)
+    {
+      return std::nullopt;
+    }
+    const std::string_view payload(reinterpret_cast<const char *>(base) + sizeof(Header), mapping->size - sizeof(Header));
+    if (header->payload_hash != hash_bytes(payload))
+    {
+      return std::nullopt;
+    }
+
+    const uint64_t counts[section_count] = {
+        header->expr_count, header->expr_count, header->expr_count,
+        header->stmt_count, header->stmt_count, header->stmt_count, header->stmt_count, header->stmt_count,
+        header->list_count, header->name_count + 1, header->name_bytes};
+    const size_t widths[section_count] = {
+        sizeof(ExprKind), sizeof(uint32_t), sizeof(uint32_t),
+        sizeof(StmtKind), sizeof(DataType), sizeof(uint32_t), sizeof(uint32_t), sizeof(uint32_t),
+        sizeof(NodeId), sizeof(uint32_t), 1};
+    for (size_t i = 0; i < section_count; i++)
+    {
+      const uint64_t offset = header->offsets[i];
+      if (offset % alignment != 0 || offset > mapping->size || counts[i] > (mapping->size - offset) / widths[i])
+      {
+        return std::nullopt;
+      }
+    }
+
+    FlatAst::Columns columns{
+        view<ExprKind>(base, header, ExprKindSection, header->expr_count),
+        view<uint32_t>(base, header, ExprASection, header->expr_count),
+        view<uint32_t>(base, header, ExprBSection, header->expr_count),
+        view<StmtKind>(base, header, StmtKindSection, header->stmt_count),
+        view<DataType>(base, header, StmtDtypeSection, header->stmt_count),
+        view<uint32_t>(base, header, StmtASection, header->stmt_count),
+        view<uint32_t>(base, header, StmtBSection, header->stmt_count),
+        view<uint32_t>(base, header, StmtCSection, header->stmt_count),
+        view<NodeId>(base, header, ListsSection, header->list_count),
+        header->prog_first,
+        header->prog_count};
+    const auto name_offsets = view<uint32_t>(base, header, NameOffsetsSection, header->name_count + 1);
+    const auto name_bytes = view<char>(base, header, NameBytesSection, header->name_bytes);
+
+    if (!names_valid(name_offsets, name_bytes.size()) || !columns_valid(columns, header->name_count))
+    {
+      return std::nullopt;
+    }
+    for (size_t i = 0; i < header->name_count; i++)
+    {
+      interner.intern(std::string_view(name_bytes.data() + name_offsets[i], name_offsets[i + 1] - name_offsets[i]));
+    }
+    return FlatAst(columns, std::move(mapping));
+  }
+
+  // Writes the cache for `src`. The file is written under a temporary name
+  // and renamed into place, so readers never see a partial cache. Failing
+  // to write a cache is not an error.
+  static bool store(const std::string &path, std::string_view src, const FlatAst &ast, const Interner &interner)
+  {
+    const FlatAst::Columns &columns = ast.columns();
+    std::vector<uint32_t> name_offsets{0};
+    std::string name_bytes;
+    for (size_t i = 0; i < interner.size(); i++)
+    {
+      name_bytes += interner.name(static_cast<SymbolId>(i));
+      name_offsets.push_back(static_cast<uint32_t>(name_bytes.size()));
+    }
+
+    Header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byte_order = byte_order;
+    header.source_size = src.size();
+    header.source_hash = hash_bytes(src);
+    header.prog_first = columns.prog_first;
+    header.prog_count = columns.prog_count;
+    header.expr_count = columns.expr_kind.size();
+    header.stmt_count = columns.stmt_kind.size();
+    header.list_count = columns.lists.size();
+    header.name_count = interner.size();
+    header.name_bytes = name_bytes.size();
+
+    std::string out(sizeof(Header), '\0');
+    auto append = [&](Section s, const void *data, size_t bytes)
+    {
+      out.resize((out.size() + alignment - 1) / alignment * alignment, '\0');
+      header.offsets[s] = out.size();
+      out.append(static_cast<const char *>(data), bytes);
+    };
+    append(ExprKindSection, columns.expr_kind.data(), columns.expr_kind.size_bytes());
+    append(ExprASection, columns.expr_a.data(), columns.expr_a.size_bytes());
+    append(ExprBSection, columns.expr_b.data(), columns.expr_b.size_bytes());
+    append(StmtKindSection, columns.stmt_kind.data(), columns.stmt_kind.size_bytes());
+    append(StmtDtypeSection, columns.stmt_dtype.data(), columns.stmt_dtype.size_bytes());
+    append(StmtASection, columns.stmt_a.data(), columns.stmt_a.size_bytes());
+    append(StmtBSection, columns.stmt_b.data(), columns.stmt_b.size_bytes());
+    append(StmtCSection, columns.stmt_c.data(), columns.stmt_c.size_bytes());
+    append(ListsSection, columns.lists.data(), columns.lists.size_bytes());
+    append(NameOffsetsSection, name_offsets.data(), name_offsets.size() * sizeof(uint32_t));
+    append(NameBytesSection, name_bytes.data(), name_bytes.size());
+    header.file_size = out.size();
+    header.payload_hash = hash_bytes(std::string_view(out).substr(sizeof(Header)));
+    std::memcpy(out.data(), &header, sizeof(Header));
+
+    const std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+      return false;
+    }
+    size_t written = 0;
+    while (written < out.size())
+    {
+      ssize_t n = ::write(fd, out.data() + written, out.size() - written);
+      if (n <= 0)
+      {
+        break;
+      }
+      written += n;
+    }
+    ::close(fd);
+    if (written != out.size() || std::rename(temp.c_str(), path.c_str()) != 0)
+    {
+      ::unlink(temp.c_str());
+      return false;
+    }
+    return true;
+  }
+
+private:
+  static constexpr char magic[8] = {'M', 'Y', 'C', 'A', 'S', 'T', '\n', '\0'};
+  static constexpr uint32_t byte_order = 0x01020304;
+  static constexpr size_t alignment = 8;
+
+  enum Section
+  {
+    ExprKindSection,
+    ExprASection,
+    ExprBSection,
+    StmtKindSection,
+    StmtDtypeSection,
+    StmtASection,
+    StmtBSection,
+    StmtCSection,
+    ListsSection,
+    NameOffsetsSection,
+    NameBytesSection,
+    section_count,
+  };
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t file_size;
+    uint64_t source_size;
+    uint64_t source_hash;
+    uint64_t payload_hash; // of everything after the header
+    uint64_t expr_count;
+    uint64_t stmt_count;
+    uint64_t list_count;
+    uint64_t name_count;
+    uint64_t name_bytes;
+    uint32_t prog_first;
+    uint32_t prog_count;
+    uint64_t offsets[section_count];
+  };
+
+  struct Mapping
+  {
+    void *data;
+    size_t size;
+
+    Mapping(void *mapped, size_t bytes) : data(mapped), size(bytes) {}
+
+    Mapping(const Mapping &other) = delete;
+
+    Mapping &operator=(const Mapping &other) = delete;
+
+    ~Mapping()
+    {
+      ::munmap(data, size);
+    }
+  };
+
+  template <typename T>
+  static std::span<const T> view(const std::byte *base, const Header *header, Section section, uint64_t count)
+  {
+    return std::span<const T>(reinterpret_cast<const T *>(base + header->offsets[section]), count);
+  }
+
+  static bool names_valid(std::span<const uint32_t> offsets, size_t bytes)
+  {
+    for (size_t i = 1; i < offsets.size(); i++)
+    {
+      if (offsets[i] < offsets[i - 1] || offsets[i] > bytes)
+      {
+        return false;
+      }
+    }
+    return offsets.front() == 0;
+  }
+
+  // Children always come before their parent in both pools, so requiring
+  // every reference to point at a lower index also rules out cycles.
+  static bool columns_valid(const FlatAst::Columns &c, uint64_t name_count)
+  {
+    for (size_t id = 0; id < c.expr_kind.size(); id++)
+    {
+      const ExprKind kind = c.expr_kind[id];
+      if (kind > ExprKind::Or)
+      {
+        return false;
+      }
+      if (kind == ExprKind::Ident && c.expr_a[id] >= name_count)
+      {
+        return false;
+      }
+      if ((kind == ExprKind::Negate || kind == ExprKind::Not || is_binary(kind)) && c.expr_a[id] >= id)
+      {
+        return false;
+      }
+      if (is_binary(kind) && c.expr_b[id] >= id)
+      {
+        return false;
+      }
+    }
+
+    const size_t exprs = c.expr_kind.size();
+    for (size_t id = 0; id < c.stmt_kind.size(); id++)
+    {
+      const uint32_t a = c.stmt_a[id], b = c.stmt_b[id], cc = c.stmt_c[id];
+      bool ok;
+      switch (c.stmt_kind[id])
+      {
+      case StmtKind::Exit:
+      case StmtKind::Print:
+        ok = a < exprs;
+        break;
+      case StmtKind::Const:
+      case StmtKind::Assign:
+        ok = a < name_count && b < exprs;
+        break;
+      case StmtKind::Let:
+        ok = a < name_count && (b < exprs || b == no_node);
+        break;
+      case StmtKind::Scope:
+        ok = static_cast<uint64_t>(a) + b <= c.lists.size();
+        for (uint32_t i = 0; ok && i < b; i++)
+        {
+          ok = c.lists[a + i] < id;
+        }
+        break;
+      case StmtKind::If:
+        ok = a < exprs && b < id && c.stmt_kind[b] == StmtKind::Scope &&
+             (cc == no_node || (cc < id && (c.stmt_kind[cc] == StmtKind::Scope || c.stmt_kind[cc] == StmtKind::If)));
+        break;
+      default:
+        ok = false;
+      }
+      if (!ok || static_cast<uint8_t>(c.stmt_dtype[id]) > static_cast<uint8_t>(DataType::Bool))
+      {
+        return false;
+      }
+    }
+
+    if (static_cast<uint64_t>(c.prog_first) + c.prog_count > c.lists.size())
+    {
+      return false;
+    }
+    for (NodeId stmt : c.lists.subspan(c.prog_first, c.prog_count))
+    {
+      if (stmt >= c.stmt_kind.size())
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include <bit>
+#include <cstdint>
+
+// How to divide by a constant without idiv, rounding toward zero like idiv
+// does (Granlund and Montgomery; Hacker's Delight, chapter 10).
+//
+// A power of two is a shift, after adding |d| - 1 to negative dividends.
+// Any other divisor multiplies by a magic number, keeps the high half of
+// the product, shifts it and adds one when it is negative. Zero, -1 (which
+// faults on INT64_MIN) and INT64_MIN keep the idiv.
+struct ConstDivisor
+{
+  enum class Kind : uint8_t
+  {
+    None, // use idiv
+    One,
+    PowerOfTwo, // |d| = 2^shift
+    Magic,
+  };
+
+  Kind kind = Kind::None;
+  int shift = 0;
+  int64_t multiplier = 0;
+
+  static ConstDivisor of(int64_t d)
+  {
+    if (d == 0 || d == -1 || d == INT64_MIN)
+      return {};
+    if (d == 1)
+      return {Kind::One};
+    const uint64_t ad = d < 0 ? 0 - static_cast<uint64_t>(d) : static_cast<uint64_t>(d);
+    if (std::has_single_bit(ad))
+      return {Kind::PowerOfTwo, std::countr_zero(ad)};
+
+    constexpr uint64_t two63 = 1ull << 63;
+    const uint64_t t = two63 + (static_cast<uint64_t>(d) >> 63);
+    const uint64_t anc = t - 1 - t % ad; // |d| times the largest quotient
+    int p = 63;
+    uint64_t q1 = two63 / anc;
+    uint64_t r1 = two63 - q1 * anc;
+    uint64_t q2 = two63 / ad;
+    uint64_t r2 = two63 - q2 * ad;
+    uint64_t delta;
+    do
+    {
+      p++;
+      q1 *= 2;
+      r1 *= 2;
+      if (r1 >= anc)
+      {
+        q1++;
+        r1 -= anc;
+      }
+      q2 *= 2;
+      r2 *= 2;
+      if (r2 >= ad)
+      {
+        q2++;
+        r2 -= ad;
+      }
+      delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+    const uint64_t magic = q2 + 1;
+    return {Kind::Magic, p - 64, static_cast<int64_t>(d < 0 ? 0 - magic : magic)};
+  }
+};
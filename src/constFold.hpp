@@ -0,0 +1,189 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "./ir.hpp"
+
+// Constant folding. evaluate() computes an instruction on known operands
+// with the semantics of the emitted code; fold_constants() is the IR pass.
+class ConstFold
+{
+public:
+  enum class Result : uint8_t
+  {
+    Ok,
+    Overflow, // the runtime check would call overflow_error (or idiv would fault)
+    DivZero,  // the runtime check would call divzero_error
+  };
+
+  // Evaluates a Neg, Not or binary instruction. `b` is ignored for the
+  // unary ones. The result is only written when it is Ok.
+  static Result evaluate(Opcode op, int64_t a, int64_t b, int64_t &result)
+  {
+    switch (op)
+    {
+    case Opcode::Neg:
+      // neg is not overflow checked, so -INT64_MIN wraps.
+      result = static_cast<int64_t>(0 - static_cast<uint64_t>(a));
+      return Result::Ok;
+    case Opcode::Not:
+      result = a == 0;
+      return Result::Ok;
+    case Opcode::Add:
+      return __builtin_add_overflow(a, b, &result) ? Result::Overflow : Result::Ok;
+    case Opcode::Sub:
+      return __builtin_sub_overflow(a, b, &result) ? Result::Overflow : Result::Ok;
+    case Opcode::Mul:
+      return __builtin_mul_overflow(a, b, &result) ? Result::Overflow : Result::Ok;
+    case Opcode::Div:
+    case Opcode::Mod:
+      if (b == 0)
+        return Result::DivZero;
+      if (a == INT64_MIN && b == -1)
+        return Result::Overflow;
+      result = op == Opcode::Div ? a / b : a % b;
+      return Result::Ok;
+    case Opcode::Eq:
+      result = a == b;
+      return Result::Ok;
+    case Opcode::Neq:
+      result = a != b;
+      return Result::Ok;
+    case Opcode::Lt:
+      result = a < b;
+      return Result::Ok;
+    case Opcode::Gt:
+      result = a > b;
+      return Result::Ok;
+    case Opcode::Lte:
+      result = a <= b;
+      return Result::Ok;
+    case Opcode::Gte:
+      result = a >= b;
+      return Result::Ok;
+    case Opcode::And:
+      result = a != 0 && b != 0;
+      return Result::Ok;
+    case Opcode::Or:
+      result = a != 0 || b != 0;
+      return Result::Ok;
+    default:
+      return Result::Overflow;
+    }
+  }
+
+  // Replaces instructions whose operands are all constants with the
+  // constant they compute, and branches on a constant with a jump. Blocks
+  // are swept in order, tracking which are still reachable, so a phi whose
+  // reachable predecessors all pass the same constant folds as well and
+  // the constants propagate through it. Instructions that would fail at run
+  // time are left alone. The blocks a folded branch no longer reaches are
+  // left for remove_unreachable_blocks.
+  static size_t fold_constants(Ir &ir)
+  {
+    std::vector<bool> reachable(ir.blocks.size(), false);
+    reachable[0] = true;
+    size_t folded = 0;
+    for (BlockId id = 0; id < ir.blocks.size(); id++)
+    {
+      Block &block = ir.blocks[id];
+      if (block.removed || !reachable[id])
+        continue;
+      bool folded_phi = false;
+      for (ValueId value : block.insts)
+      {
+        Inst &inst = ir.values[value];
+        if (inst.op == Opcode::Phi)
+        {
+          if (fold_phi(ir, value, reachable))
+          {
+            folded_phi = true;
+            folded++;
+          }
+        }
+        else if (inst.op == Opcode::Branch)
+        {
+          if (ir.values[inst.a].op == Opcode::Const)
+          {
+            fold_branch(ir, id);
+            folded++;
+          }
+        }
+        else if ((inst.op == Opcode::Neg || inst.op == Opcode::Not || is_binary(inst.op)) && is_const(ir, inst.a) &&
+                 (inst.b == no_value || is_const(ir, inst.b)))
+        {
+          int64_t result;
+          const int64_t b = inst.b == no_value ? 0 : ir.values[inst.b].imm;
+          if (evaluate(inst.op, ir.values[inst.a].imm, b, result) == Result::Ok)
+          {
+            inst = {Opcode::Const, inst.type, no_value, no_value, result, id};
+            folded++;
+          }
+        }
+      }
+      if (folded_phi)
+      {
+        // Keep the remaining phis at the start of the block.
+        std::stable_partition(block.insts.begin(), block.insts.end(), [&ir](ValueId value)
+                              { return ir.values[value].op == Opcode::Phi; });
+      }
+      for (BlockId succ : block.succ)
+      {
+        if (succ != no_block)
+        {
+          reachable[succ] = true;
+        }
+      }
+    }
+    return folded;
+  }
+
+private:
+  static bool is_const(const Ir &ir, ValueId value)
+  {
+    return ir.values[value].op == Opcode::Const;
+  }
+
+  // Folds the phi when every argument from a reachable predecessor is the
+  // same constant.
+  static bool fold_phi(Ir &ir, ValueId phi, const std::vector<bool> &reachable)
+  {
+    const Block &block = ir.blocks[ir.values[phi].block];
+    const std::span<const ValueId> args = ir.args(phi);
+    bool any = false;
+    int64_t imm = 0;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+      if (!reachable[block.preds[i]])
+        continue;
+      if (!is_const(ir, args[i]) || (any && ir.values[args[i]].imm != imm))
+        return false;
+      imm = ir.values[args[i]].imm;
+      any = true;
+    }
+    if (!any)
+      return false;
+    Inst &inst = ir.values[phi];
+    inst.op = Opcode::Const;
+    inst.imm = imm;
+    return true;
+  }
+
+  // Turns the block's branch into a jump to the side its constant
+  // condition takes. Branch targets have no phis, so the side not taken
+  // only loses a predecessor.
+  static void fold_branch(Ir &ir, BlockId id)
+  {
+    Block &block = ir.blocks[id];
+    Inst &branch = ir.values[ir.terminator(id)];
+    const bool taken = ir.values[branch.a].imm != 0;
+    const BlockId target = block.succ[taken ? 0 : 1];
+    const BlockId dropped = block.succ[taken ? 1 : 0];
+    std::vector<BlockId> &preds = ir.blocks[dropped].preds;
+    preds.erase(std::find(preds.begin(), preds.end(), id));
+    branch.op = Opcode::Jump;
+    branch.a = no_value;
+    block.succ[0] = target;
+    block.succ[1] = no_block;
+  }
+};
@@ -0,0 +1,180 @@
+#pragma once
+#include <algorithm>
+#include <span>
+#include <vector>
+#include "./ir.hpp"
+
+// Passes that delete code which can never run or whose result is unused.
+class DeadCode
+{
+public:
+  // Removes blocks that cannot be reached from the entry block, such as the
+  // code after an exit. Blocks come after their predecessors, so one sweep
+  // in block order finds them all. Phis left with a single incoming value
+  // are replaced by that value.
+  static size_t remove_unreachable_blocks(Ir &ir)
+  {
+    std::vector<bool> reachable(ir.blocks.size(), false);
+    std::vector<ValueId> forward(ir.values.size(), no_value);
+    bool forwarded = false;
+    size_t removed = 0;
+    reachable[0] = true;
+    for (BlockId id = 0; id < ir.blocks.size(); id++)
+    {
+      Block &block = ir.blocks[id];
+      if (block.removed)
+        continue;
+      if (reachable[id])
+      {
+        for (BlockId succ : block.succ)
+        {
+          if (succ != no_block)
+          {
+            reachable[succ] = true;
+          }
+        }
+        continue;
+      }
+      for (BlockId succ : block.succ)
+      {
+        if (succ != no_block && !ir.blocks[succ].removed)
+        {
+          forwarded |= drop_pred(ir, succ, id, forward);
+        }
+      }
+      for (ValueId value : block.insts)
+      {
+        ir.values[value].block = no_block;
+      }
+      block.insts.clear();
+      block.preds.clear();
+      block.succ[0] = block.succ[1] = no_block;
+      block.removed = true;
+      removed++;
+    }
+    if (forwarded)
+    {
+      rewrite_operands(ir, forward);
+    }
+    return removed;
+  }
+
+  // Removes instructions whose result is never read and that have no side
+  // effects. Arithmetic that can fail at run time is kept.
+  static size_t remove_dead_values(Ir &ir)
+  {
+    std::vector<uint32_t> uses(ir.values.size(), 0);
+    for (const Block &block : ir.blocks)
+    {
+      for (ValueId value : block.insts)
+      {
+        ir.for_each_operand(value, [&uses](ValueId operand)
+                            { uses[operand]++; });
+      }
+    }
+
+    std::vector<ValueId> dead;
+    for (const Block &block : ir.blocks)
+    {
+      for (ValueId value : block.insts)
+      {
+        if (uses[value] == 0 && !ir.has_side_effects(value))
+        {
+          dead.push_back(value);
+        }
+      }
+    }
+    size_t removed = 0;
+    while (!dead.empty())
+    {
+      const ValueId value = dead.back();
+      dead.pop_back();
+      ir.for_each_operand(value, [&](ValueId operand)
+                          {
+                            if (--uses[operand] == 0 && !ir.has_side_effects(operand))
+                            {
+                              dead.push_back(operand);
+                            } });
+      ir.values[value].block = no_block;
+      removed++;
+    }
+
+    if (removed > 0)
+    {
+      for (Block &block : ir.blocks)
+      {
+        std::erase_if(block.insts, [&ir](ValueId value)
+                      { return ir.values[value].block == no_block; });
+      }
+    }
+    return removed;
+  }
+
+private:
+  // Removes `pred` from the predecessors of `block` along with the matching
+  // phi arguments. Phis whose remaining arguments all agree are recorded in
+  // `forward` and removed; returns whether there were any.
+  static bool drop_pred(Ir &ir, BlockId block, BlockId pred, std::vector<ValueId> &forward)
+  {
+    Block &target = ir.blocks[block];
+    const size_t index = std::find(target.preds.begin(), target.preds.end(), pred) - target.preds.begin();
+    for (ValueId value : target.insts)
+    {
+      if (ir.values[value].op != Opcode::Phi)
+        break;
+      const std::span<ValueId> args = ir.args(value);
+      std::copy(args.begin() + index + 1, args.end(), args.begin() + index);
+    }
+    target.preds.erase(target.preds.begin() + index);
+
+    bool any = false;
+    for (ValueId value : target.insts)
+    {
+      if (ir.values[value].op != Opcode::Phi)
+        break;
+      const std::span<const ValueId> args = ir.args(value);
+      if (!args.empty() && std::all_of(args.begin(), args.end(), [&args](ValueId arg)
+                                       { return arg == args[0]; }))
+      {
+        forward[value] = args[0];
+        ir.values[value].block = no_block;
+        any = true;
+      }
+    }
+    if (any)
+    {
+      std::erase_if(target.insts, [&ir](ValueId value)
+                    { return ir.values[value].block == no_block; });
+    }
+    return any;
+  }
+
+  static void rewrite_operands(Ir &ir, const std::vector<ValueId> &forward)
+  {
+    auto resolve = [&forward](ValueId value)
+    {
+      while (value != no_value && forward[value] != no_value)
+      {
+        value = forward[value];
+      }
+      return value;
+    };
+    for (const Block &block : ir.blocks)
+    {
+      for (ValueId value : block.insts)
+      {
+        Inst &inst = ir.values[value];
+        if (inst.op == Opcode::Phi)
+        {
+          for (ValueId &arg : ir.args(value))
+          {
+            arg = resolve(arg);
+          }
+          continue;
+        }
+        inst.a = resolve(inst.a);
+        inst.b = resolve(inst.b);
+      }
+    }
+  }
+};
@@ -0,0 +1,445 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+#include "./parser.hpp"
+
+// Compact, index-based form of the AST.
+//
+// Nodes are identified by 32-bit indices into struct-of-arrays pools: one
+// pool for expressions and one for statements. Each pool stores a kind byte
+// and two or three 32-bit operand words per node; there are no pointers and
+// no per-node allocations. Literal values are split across the two operand
+// words of an expression, and scope bodies are ranges in a shared `lists`
+// array. An if/elif/else chain is stored as nested If statements whose else
+// branch is either a Scope or another If.
+//
+// Expressions are appended in post-order, so a subtree always occupies a
+// contiguous index range that ends at its root.
+
+using NodeId = uint32_t;
+inline constexpr NodeId no_node = UINT32_MAX;
+
+enum class ExprKind : uint8_t
+{
+  IntLit,
+  CharLit,
+  BoolLit,
+  Ident,
+  Negate,
+  Not,
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Mod,
+  Eq,
+  Neq,
+  Lt,
+  Gt,
+  Lte,
+  Gte,
+  And,
+  Or,
+};
+
+// The binary kinds are laid out in BinOp order.
+inline constexpr ExprKind binary_kind(BinOp op)
+{
+  return static_cast<ExprKind>(static_cast<uint8_t>(ExprKind::Add) + static_cast<uint8_t>(op));
+}
+
+inline constexpr bool is_binary(ExprKind kind)
+{
+  return kind >= ExprKind::Add;
+}
+
+static_assert(binary_kind(BinOp::Mod) == ExprKind::Mod && binary_kind(BinOp::Gte) == ExprKind::Gte &&
+              binary_kind(BinOp::Or) == ExprKind::Or);
+
+enum class StmtKind : uint8_t
+{
+  Exit,
+  Print,
+  Const,
+  Let,
+  Assign,
+  Scope,
+  If,
+};
+
+class FlatAst
+{
+public:
+  struct Expr
+  {
+    ExprKind kind;
+    uint32_t a;
+    uint32_t b;
+
+    BinOp op() const { return static_cast<BinOp>(static_cast<uint8_t>(kind) - static_cast<uint8_t>(ExprKind::Add)); }
+    NodeId lhs() const { return a; }
+    NodeId rhs() const { return b; }
+    NodeId operand() const { return a; }
+    SymbolId symbol() const { return a; }
+    int64_t literal() const { return static_cast<int64_t>(static_cast<uint64_t>(b) << 32 | a); }
+  };
+
+  // Field use per kind:
+  //   Exit, Print  a = expr
+  //   Const, Let   a = symbol, b = expr (no_node for a let without value), dtype
+  //   Assign       a = symbol, b = expr
+  //   Scope        a = first index into the statement lists, b = count
+  //   If           a = condition, b = then scope, c = else branch or no_node
+  struct Stmt
+  {
+    StmtKind kind;
+    DataType dtype;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+
+    NodeId expr() const { return kind == StmtKind::Const || kind == StmtKind::Let || kind == StmtKind::Assign ? b : a; }
+    SymbolId symbol() const { return a; }
+    NodeId cond() const { return a; }
+    NodeId then_scope() const { return b; }
+    NodeId else_branch() const { return c; }
+  };
+
+  // The node columns. A built AST's columns point into the vectors of its
+  // Builder; a loaded AST's columns can point straight into a mapped file.
+  struct Columns
+  {
+    std::span<const ExprKind> expr_kind;
+    std::span<const uint32_t> expr_a;
+    std::span<const uint32_t> expr_b;
+
+    std::span<const StmtKind> stmt_kind;
+    std::span<const DataType> stmt_dtype;
+    std::span<const uint32_t> stmt_a;
+    std::span<const uint32_t> stmt_b;
+    std::span<const uint32_t> stmt_c;
+
+    std::span<const NodeId> lists;
+    uint32_t prog_first = 0;
+    uint32_t prog_count = 0;
+  };
+
+  // Appends nodes to growable columns; finish() turns them into a FlatAst.
+  class Builder
+  {
+  public:
+    NodeId add_expr(ExprKind kind, uint32_t a = 0, uint32_t b = 0)
+    {
+      m_expr_kind.push_back(kind);
+      m_expr_a.push_back(a);
+      m_expr_b.push_back(b);
+      return static_cast<NodeId>(m_expr_kind.size() - 1);
+    }
+
+    NodeId add_literal(ExprKind kind, int64_t value)
+    {
+      const auto bits = static_cast<uint64_t>(value);
+      return add_expr(kind, static_cast<uint32_t>(bits), static_cast<uint32_t>(bits >> 32));
+    }
+
+    NodeId add_stmt(StmtKind kind, uint32_t a = 0, uint32_t b = 0, uint32_t c = no_node, DataType dtype = DataType::Int)
+    {
+      m_stmt_kind.push_back(kind);
+      m_stmt_dtype.push_back(dtype);
+      m_stmt_a.push_back(a);
+      m_stmt_b.push_back(b);
+      m_stmt_c.push_back(c);
+      return static_cast<NodeId>(m_stmt_kind.size() - 1);
+    }
+
+    // Appends a statement list and returns its first index.
+    uint32_t add_list(std::span<const NodeId> stmts)
+    {
+      const auto first = static_cast<uint32_t>(m_lists.size());
+      m_lists.insert(m_lists.end(), stmts.begin(), stmts.end());
+      return first;
+    }
+
+    void set_program(uint32_t first, uint32_t count)
+    {
+      m_prog_first = first;
+      m_prog_count = count;
+    }
+
+    FlatAst finish() &&
+    {
+      auto storage = std::make_shared<Builder>(std::move(*this));
+      Columns columns{storage->m_expr_kind, storage->m_expr_a, storage->m_expr_b,
+                      storage->m_stmt_kind, storage->m_stmt_dtype, storage->m_stmt_a, storage->m_stmt_b, storage->m_stmt_c,
+                      storage->m_lists, storage->m_prog_first, storage->m_prog_count};
+      return FlatAst(columns, std::move(storage));
+    }
+
+  private:
+    std::vector<ExprKind> m_expr_kind;
+    std::vector<uint32_t> m_expr_a;
+    std::vector<uint32_t> m_expr_b;
+
+    std::vector<StmtKind> m_stmt_kind;
+    std::vector<DataType> m_stmt_dtype;
+    std::vector<uint32_t> m_stmt_a;
+    std::vector<uint32_t> m_stmt_b;
+    std::vector<uint32_t> m_stmt_c;
+
+    std::vector<NodeId> m_lists;
+    uint32_t m_prog_first = 0;
+    uint32_t m_prog_count = 0;
+  };
+
+  FlatAst() = default;
+
+  // Wraps columns whose memory is kept alive by `owner`.
+  FlatAst(const Columns &columns, std::shared_ptr<const void> owner)
+      : m_columns(columns), m_owner(std::move(owner)) {}
+
+  const Columns &columns() const
+  {
+    return m_columns;
+  }
+
+  Expr expr(NodeId id) const
+  {
+    return {m_columns.expr_kind[id], m_columns.expr_a[id], m_columns.expr_b[id]};
+  }
+
+  Stmt stmt(NodeId id) const
+  {
+    return {m_columns.stmt_kind[id], m_columns.stmt_dtype[id], m_columns.stmt_a[id], m_columns.stmt_b[id], m_columns.stmt_c[id]};
+  }
+
+  std::span<const NodeId> body(NodeId scope) const
+  {
+    return m_columns.lists.subspan(m_columns.stmt_a[scope], m_columns.stmt_b[scope]);
+  }
+
+  std::span<const NodeId> program() const
+  {
+    return m_columns.lists.subspan(m_columns.prog_first, m_columns.prog_count);
+  }
+
+  // First index of the post-order range holding the subtree rooted at `root`.
+  NodeId subtree_begin(NodeId root) const
+  {
+    NodeId id = root;
+    while (m_columns.expr_kind[id] >= ExprKind::Negate)
+    {
+      id = m_columns.expr_a[id];
+    }
+    return id;
+  }
+
+  size_t expr_count() const
+  {
+    return m_columns.expr_kind.size();
+  }
+
+  size_t stmt_count() const
+  {
+    return m_columns.stmt_kind.size();
+  }
+
+  size_t memory_bytes() const
+  {
+    return expr_count() * (sizeof(ExprKind) + 2 * sizeof(uint32_t)) +
+           stmt_count() * (sizeof(StmtKind) + sizeof(DataType) + 3 * sizeof(uint32_t)) +
+           m_columns.lists.size() * sizeof(NodeId);
+  }
+
+private:
+  Columns m_columns;
+  std::shared_ptr<const void> m_owner;
+};
+
+// Lowers the parser's pointer AST into a FlatAst.
+class Flattener
+{
+public:
+  FlatAst flatten(const NodeProg &prog)
+  {
+    std::vector<NodeId> stmts;
+    stmts.reserve(prog.stmts.size());
+    for (const NodeStmt *stmt : prog.stmts)
+    {
+      stmts.push_back(flatten_stmt(stmt));
+    }
+    const uint32_t first = ast.add_list(stmts);
+    ast.set_program(first, static_cast<uint32_t>(stmts.size()));
+    return std::move(ast).finish();
+  }
+
+private:
+  // Iterative post-order walk, so deep expressions do not grow the native
+  // stack. A frame holds either an expression or a term; operator frames are
+  // revisited with `operands_done` set once their operands are flattened.
+  NodeId flatten_expr(const NodeExpr *root)
+  {
+    work.clear();
+    ids.clear();
+    work.push_back({root, nullptr, false});
+    while (!work.empty())
+    {
+      const Frame frame = work.back();
+      work.pop_back();
+      if (frame.expr != nullptr)
+      {
+        if (auto *term = std::get_if<NodeTerm *>(&frame.expr->var))
+        {
+          work.push_back({nullptr, *term, false});
+          continue;
+        }
+        const NodeBinExpr *bin_expr = std::get<NodeBinExpr *>(frame.expr->var);
+        if (!frame.operands_done)
+        {
+          work.push_back({frame.expr, nullptr, true});
+          work.push_back({bin_expr->rhs, nullptr, false});
+          work.push_back({bin_expr->lhs, nullptr, false});
+        }
+        else
+        {
+          const NodeId rhs = ids.back();
+          ids.pop_back();
+          ids.back() = ast.add_expr(binary_kind(bin_expr->op), ids.back(), rhs);
+        }
+        continue;
+      }
+
+      const NodeTerm *term = frame.term;
+      if (auto *term_unary = std::get_if<NodeTermUnary *>(&term->val))
+      {
+        if (!frame.operands_done)
+        {
+          work.push_back({nullptr, term, true});
+          work.push_back({nullptr, (*term_unary)->operand, false});
+        }
+        else
+        {
+          ids.back() = ast.add_expr((*term_unary)->op == UnaryOp::Negate ? ExprKind::Negate : ExprKind::Not, ids.back());
+        }
+      }
+      else if (auto *term_paren = std::get_if<NodeTermParen *>(&term->val))
+      {
+        work.push_back({(*term_paren)->expr, nullptr, false});
+      }
+      else if (auto *term_ident = std::get_if<NodeTermIdent *>(&term->val))
+      {
+        ids.push_back(ast.add_expr(ExprKind::Ident, (*term_ident)->ident));
+      }
+      else
+      {
+        ids.push_back(flatten_lit(std::get<NodeTermLit *>(term->val)));
+      }
+    }
+    return ids.back();
+  }
+
+  NodeId flatten_lit(const NodeTermLit *term_lit)
+  {
+    switch (term_lit->token.type)
+    {
+    case TokenType::int_lit:
+      return ast.add_literal(ExprKind::IntLit, term_lit->token.value);
+    case TokenType::char_lit:
+      return ast.add_literal(ExprKind::CharLit, term_lit->token.value);
+    case TokenType::bool_lit:
+      return ast.add_literal(ExprKind::BoolLit, term_lit->token.value);
+    default:
+      std::cerr << "Unknown literal type\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  NodeId flatten_scope(const NodeStmtScope *scope)
+  {
+    std::vector<NodeId> stmts;
+    stmts.reserve(scope->stmts.size());
+    for (const NodeStmt *stmt : scope->stmts)
+    {
+      stmts.push_back(flatten_stmt(stmt));
+    }
+    const uint32_t first = ast.add_list(stmts);
+    return ast.add_stmt(StmtKind::Scope, first, static_cast<uint32_t>(stmts.size()));
+  }
+
+  NodeId flatten_if(const NodeExpr *cond, const NodeStmtScope *scope, std::optional<NodeStmtIfCont *> cont)
+  {
+    NodeId cond_id = flatten_expr(cond);
+    NodeId then_id = flatten_scope(scope);
+    NodeId else_id = no_node;
+    if (cont.has_value())
+    {
+      struct ContVisitor
+      {
+        Flattener *f;
+        NodeId operator()(const NodeStmtElif *stmt_elif) const
+        {
+          return f->flatten_if(stmt_elif->expr, stmt_elif->scope, stmt_elif->cont);
+        }
+        NodeId operator()(const NodeStmtElse *stmt_else) const
+        {
+          return f->flatten_scope(stmt_else->scope);
+        }
+      };
+      else_id = std::visit(ContVisitor{this}, cont.value()->clause);
+    }
+    return ast.add_stmt(StmtKind::If, cond_id, then_id, else_id);
+  }
+
+  NodeId flatten_stmt(const NodeStmt *stmt)
+  {
+    struct StmtVisitor
+    {
+      Flattener *f;
+      NodeId operator()(const NodeStmtExit *stmt_exit) const
+      {
+        return f->ast.add_stmt(StmtKind::Exit, f->flatten_expr(stmt_exit->expr));
+      }
+      NodeId operator()(const NodeStmtPrint *stmt_print) const
+      {
+        return f->ast.add_stmt(StmtKind::Print, f->flatten_expr(stmt_print->expr));
+      }
+      NodeId operator()(const NodeStmtConst *stmt_const) const
+      {
+        NodeId expr = f->flatten_expr(stmt_const->expr);
+        return f->ast.add_stmt(StmtKind::Const, stmt_const->ident, expr, no_node, stmt_const->dtype);
+      }
+      NodeId operator()(const NodeStmtLet *stmt_let) const
+      {
+        NodeId expr = stmt_let->expr.has_value() ? f->flatten_expr(stmt_let->expr.value()) : no_node;
+        return f->ast.add_stmt(StmtKind::Let, stmt_let->ident, expr, no_node, stmt_let->dtype);
+      }
+      NodeId operator()(const NodeStmtAssign *stmt_assign) const
+      {
+        NodeId expr = f->flatten_expr(stmt_assign->expr);
+        return f->ast.add_stmt(StmtKind::Assign, stmt_assign->ident, expr);
+      }
+      NodeId operator()(const NodeStmtScope *stmt_scope) const
+      {
+        return f->flatten_scope(stmt_scope);
+      }
+      NodeId operator()(const NodeStmtIf *stmt_if) const
+      {
+        return f->flatten_if(stmt_if->expr, stmt_if->scope, stmt_if->cont);
+      }
+    };
+    return std::visit(StmtVisitor{this}, stmt->stmt);
+  }
+
+  struct Frame
+  {
+    const NodeExpr *expr;
+    const NodeTerm *term;
+    bool operands_done;
+  };
+
+  FlatAst::Builder ast;
+  // Scratch stacks for flatten_expr(), kept to reuse their capacity.
+  std::vector<Frame> work;
+  std::vector<NodeId> ids;
+};
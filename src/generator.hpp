@@ -1,781 +1,658 @@
-#include <vector>
+#include <algorithm>
+#include <bit>
+#include <iterator>
+#include <optional>
 #include <sstream>
-#include <unordered_map>
-
+#include <string>
+#include <string_view>
+#include <vector>
+#include "./ir.hpp"
+#include "./regAlloc.hpp"
+#include "./asm.hpp"
+#include "./constDivisor.hpp"
+#include "./rangeAnalysis.hpp"
+#include "./peephole.hpp"
+
+// Emits x86-64 assembly for the SSA IR, using the locations chosen by the
+// register allocator. Values live in registers or frame slots; rax is the
+// only scratch register, and it also carries results whose own location is
+// a frame slot, or that are never read. The code is built as a list of
+// AsmInsts and goes through the peephole optimiser before it is printed.
+//
+// A branch condition the allocator fused is never materialised as 0/1: its
+// comparisons jump on the flags they set. Arithmetic that range analysis
+// proved can't overflow skips its overflow check.
 class Generator
 {
 
 public:
-  explicit Generator(NodeProg program) : prog(std::move(program)) {}
-  DataType gen_lit(const NodeTermLit *term_lit)
-  {
-    const Token &tok = term_lit->token;
+  Generator(const Ir &program, const RegAlloc &allocation, const RangeAnalysis &range_analysis)
+      : ir(program), regs(allocation), ranges(range_analysis), next_label(static_cast<uint32_t>(program.blocks.size())) {}
 
-    switch (tok.type)
-    {
-    case TokenType::int_lit:
+  std::string gen_prog(Peephole &peephole)
+  {
+    if (regs.frame_size() > 0)
     {
+      emit(Mnemonic::Sub, AsmOperand::reg(Reg::rsp), imm(regs.frame_size() * 8));
+    }
 
-      int64_t value;
-      try
+    const std::vector<BlockId> &order = regs.order();
+    for (size_t i = 0; i < order.size(); i++)
+    {
+      const BlockId id = order[i];
+      const BlockId next = i + 1 < order.size() ? order[i + 1] : no_block;
+      if (i > 0)
       {
-        size_t idx;
-        value = std::stoll(tok.val.value(), &idx, 10);
-        if (idx != tok.val.value().size())
-        {
-          throw std::invalid_argument("Invalid integer literal");
-        }
+        // Whatever is live into the block is live at the end of the one
+        // laid out before it.
+        code.push_back({Mnemonic::Label, label(id), {}, regs.live_across(order[i - 1])});
       }
-      catch (const std::out_of_range &)
+      for (ValueId value : ir.blocks[id].insts)
       {
-        std::cerr << "Integer literal out of bounds\n";
-        exit(EXIT_FAILURE);
+        gen_inst(value, next);
       }
-      catch (const std::invalid_argument &)
+    }
+    peephole.run(code);
+
+    std::stringstream output;
+    output << "extern print_int\n"
+           << "extern print_string\n"
+           << "extern print_char\n"
+           << "extern overflow_error\n"
+           << "extern divzero_error\n"
+           << "global _start\n"
+           << "_start:\n";
+    for (const AsmInst &inst : code)
+    {
+      output << inst;
+    }
+    return output.str();
+  }
+
+  // A program whose output and exit code were computed at compile time:
+  // one write of the output, then the exit. Without a code it exits with
+  // the process argument count.
+  static std::string gen_precomputed(std::string_view bytes, std::optional<int64_t> code)
+  {
+    std::stringstream output;
+    if (!bytes.empty())
+    {
+      output << "section .data\n";
+      for (size_t i = 0; i < bytes.size(); i++)
       {
-        std::cerr << "Invalid integer literal\n";
-        exit(EXIT_FAILURE);
+        output << (i == 0 ? "output db " : i % 16 == 0 ? "\n    db " : ", ")
+               << static_cast<unsigned>(static_cast<unsigned char>(bytes[i]));
       }
-      output << "    mov rax, " << value << "\n";
-      push("rax");
-      return DataType::Int;
+      output << "\nsection .text\n";
     }
-    case TokenType::char_lit:
+    output << "global _start\n"
+           << "_start:\n";
+    if (!bytes.empty())
+    {
+      output << "    mov rax, 1\n";
+      output << "    mov rdi, 1\n";
+      output << "    mov rsi, output\n";
+      output << "    mov rdx, " << bytes.size() << "\n";
+      output << "    syscall\n";
+    }
+    output << "    mov rax, 60\n";
+    if (code)
     {
-      char value = tok.val.value()[0];
-      output << "    mov rax, " << static_cast<int64_t>(value) << "\n";
-      push("rax");
-      return DataType::Char;
+      output << "    mov rdi, " << *code << "\n";
     }
-    case TokenType::bool_lit:
+    else
     {
-      std::string value = tok.val.value();
+      output << "    mov rdi, [rsp]\n";
+    }
+    output << "    syscall\n";
+    return output.str();
+  }
 
-      if (value == "true")
+private:
+  enum class Lowering : uint8_t
+  {
+    Arith,   // insn on the result register and rhs, then an overflow check
+    Divide,  // idiv with a zero check, result in `result`
+    Compare, // cmp then the setcc in insn
+    Logical, // normalise both to 0/1 in al and ah, then insn al, ah
+  };
+
+  struct BinOpInfo
+  {
+    Lowering lowering;
+    Mnemonic insn;
+    Reg result;
+  };
+
+  // Indexed by BinOp.
+  static constexpr BinOpInfo bin_ops[] = {
+      {Lowering::Arith, Mnemonic::Add, Reg::rax},
+      {Lowering::Arith, Mnemonic::Sub, Reg::rax},
+      {Lowering::Arith, Mnemonic::Imul, Reg::rax},
+      {Lowering::Divide, Mnemonic::Idiv, Reg::rax},
+      {Lowering::Divide, Mnemonic::Idiv, Reg::rdx},
+      {Lowering::Compare, Mnemonic::Sete, Reg::rax},
+      {Lowering::Compare, Mnemonic::Setne, Reg::rax},
+      {Lowering::Compare, Mnemonic::Setl, Reg::rax},
+      {Lowering::Compare, Mnemonic::Setg, Reg::rax},
+      {Lowering::Compare, Mnemonic::Setle, Reg::rax},
+      {Lowering::Compare, Mnemonic::Setge, Reg::rax},
+      {Lowering::Logical, Mnemonic::And, Reg::rax},
+      {Lowering::Logical, Mnemonic::Or, Reg::rax},
+  };
+  static_assert(std::size(bin_ops) == static_cast<size_t>(BinOp::Or) + 1);
+
+  // Indexed by BinOp, from Eq to Gte.
+  static constexpr Mnemonic jump_if_true[] = {Mnemonic::Je, Mnemonic::Jne, Mnemonic::Jl,
+                                              Mnemonic::Jg, Mnemonic::Jle, Mnemonic::Jge};
+  static constexpr Mnemonic jump_if_false[] = {Mnemonic::Jne, Mnemonic::Je, Mnemonic::Jge,
+                                               Mnemonic::Jle, Mnemonic::Jg, Mnemonic::Jl};
+
+  void gen_inst(ValueId id, BlockId next)
+  {
+    if (regs.fused(id))
+      return;
+    const Inst &inst = ir.values[id];
+    switch (inst.op)
+    {
+    case Opcode::Const:
+    {
+      const Location dst = regs.location(id);
+      if (dst.kind == Location::Kind::Reg)
       {
-        output << "    mov rax, 1\n";
-        push("rax");
+        emit(Mnemonic::Mov, at(id), imm(inst.imm));
       }
-      else if (value == "false")
+      else if (dst.kind == Location::Kind::Slot)
       {
-        output << "    mov rax, 0\n";
-        push("rax");
+        emit(Mnemonic::Mov, rax, imm(inst.imm));
+        emit(Mnemonic::Mov, at(id), rax);
       }
-      else
+      // An immediate is encoded where it is read.
+      break;
+    }
+    case Opcode::Argc:
+      // argc sits just above the frame.
+      if (regs.location(id).kind != Location::Kind::None)
       {
-        std::cerr << "Unknown boolean literal: " << value << "\n";
-        exit(EXIT_FAILURE);
+        emit(Mnemonic::Mov, AsmOperand::reg(result_reg(id)), {AsmOperand::Kind::Slot, regs.frame_size() * 8});
+        store_result(id);
       }
-
-      return DataType::Bool;
-    }
-    default:
-      std::cerr << "Unknown literal type\n";
-      exit(EXIT_FAILURE);
+      break;
+    case Opcode::Neg:
+    {
+      const Reg dst = result_reg(id);
+      move(dst, inst.a);
+      emit(Mnemonic::Neg, AsmOperand::reg(dst));
+      store_result(id);
+      break;
     }
-  }
-  DataType gen_term(const NodeTerm *term)
-  {
-    struct TermVisitor
+    case Opcode::Not:
+      compare_zero(inst.a);
+      // Set AL to 1 if the operand was 0, else 0
+      emit(Mnemonic::Sete, al);
+      set_from_al(id);
+      break;
+    case Opcode::Phi:
+      // Filled by the copies at the end of each predecessor.
+      break;
+    case Opcode::Print:
+      move(Reg::rdi, inst.a);
+      emit(Mnemonic::Call, symbol(inst.type == DataType::Char ? "print_char" : "print_int"));
+      break;
+    case Opcode::Jump:
     {
-      Generator *gen;
-      DataType operator()(const NodeTermLit *term_lit) const
+      const BlockId target = ir.blocks[inst.block].succ[0];
+      gen_phi_copies(inst.block, target);
+      if (target != next)
       {
-        return gen->gen_lit(term_lit);
+        code.push_back({Mnemonic::Jmp, label(target), {}, regs.live_across(inst.block)});
       }
-      DataType operator()(const NodeTermIdent *term_ident) const
-      {
-        if (!gen->globals.contains(term_ident->ident.val.value()))
-        {
-          std::cerr << "Variable " << term_ident->ident.val.value() << " not declared" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        const auto &var = gen->globals.at(term_ident->ident.val.value());
-        std::stringstream offset;
-        offset << "QWORD [rsp + " << (gen->stack_size - var.stack_loc) * 8 << "]";
-        gen->push(offset.str());
-        return var.dtype;
-      }
-      DataType operator()(const NodeTermParen *term_paren) const
+      break;
+    }
+    case Opcode::Branch:
+    {
+      const Block &block = ir.blocks[inst.block];
+      if (block.succ[1] == next)
       {
-        return gen->gen_expr(term_paren->expr);
+        jump_if(inst.a, true, label(block.succ[0]), regs.live_across(inst.block));
+        break;
       }
-      DataType operator()(const NodeTermUnary *term_unary) const
+      jump_if(inst.a, false, label(block.succ[1]), regs.live_across(inst.block));
+      if (block.succ[0] != next)
       {
-        switch (term_unary->op)
-        {
-        case UnaryOp::Negate:
-        {
-          DataType dtype = gen->gen_term(term_unary->operand);
-          if (dtype != DataType::Int)
-          {
-            std::cerr << "Cannot use '-' on non integers\n";
-            exit(EXIT_FAILURE);
-          }
-          gen->pop("rax");
-          gen->output << "    neg rax\n";
-          gen->push("rax");
-          return DataType::Int;
-        }
-        case UnaryOp::Not:
-        {
-          DataType dtype = gen->gen_term(term_unary->operand);
-          if (dtype != DataType::Int && dtype != DataType::Bool)
-          {
-            std::cerr << "Cannot use '!' on non-integers or non-booleans\n";
-            exit(EXIT_FAILURE);
-          }
-
-          gen->pop("rax");
-          // Compare rax with 0
-          gen->output << "    cmp rax, 0\n";
-          // Set AL to 1 if equal (operand was 0), else 0
-          gen->output << "    sete al\n";
-          // Zero-extend AL into RAX
-          gen->output << "    movzx rax, al\n";
-          gen->push("rax");
-
-          return DataType::Bool;
-        }
-
-        default:
-          std::cerr << "Unknown unary operator\n";
-          exit(EXIT_FAILURE);
-        }
+        code.push_back({Mnemonic::Jmp, label(block.succ[0]), {}, regs.live_across(inst.block)});
       }
-    };
-    TermVisitor visitor(this);
-    return std::visit(visitor, term->val);
+      break;
+    }
+    case Opcode::Exit:
+      gen_exit(inst.a);
+      break;
+    default:
+      gen_bin_op(bin_ops[static_cast<size_t>(binary_op(inst.op))], id);
+      break;
+    }
   }
 
-  DataType gen_bin_expr(const NodeBinExpr *bin_expr)
+  // The allocator never gives the result the register of an operand, so
+  // the result register can be written before the operands are read.
+  void gen_bin_op(const BinOpInfo &info, ValueId id)
   {
-    struct BinExprVisitor
+    const Inst &inst = ir.values[id];
+    switch (info.lowering)
+    {
+    case Lowering::Arith:
     {
-      Generator *gen;
-      DataType operator()(const NodeBinExprAdd *add) const
+      const Reg dst = result_reg(id);
+      const bool checked = ranges.needs_check(id);
+      // x * 2 is x + x, which sets the overflow flag the same way. Larger
+      // powers of two become a shift, which doesn't set it, only when the
+      // product can't overflow.
+      const int shift = inst.op == Opcode::Mul ? std::max(log2_of(inst.a), log2_of(inst.b)) : 0;
+      if (shift == 1 || (shift > 1 && !checked))
       {
-        DataType lhs_type = gen->gen_expr(add->lhs);
-        DataType rhs_type = gen->gen_expr(add->rhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
+        move(dst, log2_of(inst.b) == shift ? inst.a : inst.b);
+        if (shift == 1)
         {
-          std::cerr << "Error: Addition operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
+          emit(Mnemonic::Add, AsmOperand::reg(dst), AsmOperand::reg(dst));
         }
-
-        gen->pop("rax");
-        gen->pop("rbx");
-        gen->output << "    add rax, rbx\n";
-        gen->output << "    jo overflow_error\n";
-        gen->push("rax");
-        return DataType::Int;
-      }
-      DataType operator()(const NodeBinExprMul *mul) const
-      {
-        DataType lhs_type = gen->gen_expr(mul->lhs);
-        DataType rhs_type = gen->gen_expr(mul->rhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
+        else
         {
-          std::cerr << "Error: Multiplication operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
+          emit(Mnemonic::Shl, AsmOperand::reg(dst), imm(shift));
         }
-
-        gen->pop("rax");
-        gen->pop("rbx");
-        gen->output << "    imul rbx\n";
-        gen->output << "    jo overflow_error\n";
-        gen->push("rax");
-        return DataType::Int;
       }
-
-      DataType operator()(const NodeBinExprSub *sub) const
+      else
       {
-        DataType rhs_type = gen->gen_expr(sub->rhs);
-        DataType lhs_type = gen->gen_expr(sub->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
-        {
-          std::cerr << "Error: Subtraction operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-
-        gen->pop("rax");
-        gen->pop("rbx");
-        gen->output << "    sub rax, rbx\n";
-        gen->output << "    jo overflow_error\n";
-        gen->push("rax");
-        return DataType::Int;
+        move(dst, inst.a);
+        emit(info.insn, AsmOperand::reg(dst), at(inst.b));
       }
-
-      DataType operator()(const NodeBinExprDiv *div) const
+      if (checked)
       {
-        DataType rhs_type = gen->gen_expr(div->rhs);
-        DataType lhs_type = gen->gen_expr(div->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
-        {
-          std::cerr << "Error: Division operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax");
-        gen->pop("rbx");
-        gen->output << "    cmp rbx, 0\n";
-        gen->output << "    je divzero_error\n"; // check division by zero
-        gen->output << "    cqo\n";              // sign-extend RAX -> RDX:RAX
-        gen->output << "    idiv rbx\n";         // RAX/RBX -> quotient in RAX, remainder in RDX
-        gen->push("rax");
-        return DataType::Int;
+        emit(Mnemonic::Jo, symbol("overflow_error"));
       }
-
-      DataType operator()(const NodeBinExprMod *mod) const
+      store_result(id);
+      break;
+    }
+    case Lowering::Divide:
+    {
+      const Inst &divisor = ir.values[inst.b];
+      if (divisor.op == Opcode::Const)
       {
-        DataType rhs_type = gen->gen_expr(mod->rhs);
-        DataType lhs_type = gen->gen_expr(mod->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
+        const ConstDivisor by = ConstDivisor::of(divisor.imm);
+        if (by.kind != ConstDivisor::Kind::None)
         {
-          std::cerr << "Error: Modulo operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
+          gen_const_divide(id, divisor.imm, by, info.result == Reg::rdx);
+          break;
         }
-        gen->pop("rax");
-        gen->pop("rbx");
-        gen->output << "    cmp rbx, 0\n";
-        gen->output << "    je divzero_error\n"; // check division by zero
-        gen->output << "    cqo\n";
-        gen->output << "    idiv rbx\n";
-        gen->push("rdx");
-        return DataType::Int;
       }
-
-      DataType operator()(const NodeBinExprEq *eq) const
+      // The divisor is never in rax or rdx. A constant one isn't zero.
+      if (divisor.op != Opcode::Const || divisor.imm == 0)
       {
-        DataType rhs_type = gen->gen_expr(eq->rhs);
-        DataType lhs_type = gen->gen_expr(eq->lhs);
-
-        if (lhs_type != rhs_type)
-        {
-          std::cerr << "Error: Equality comparison requires both operands to be of the same type" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax");
-        gen->pop("rbx");
-        gen->output << "    cmp rax, rbx\n";
-        gen->output << "    sete al\n";
-        gen->output << "    movzx rax, al\n";
-        gen->push("rax");
-        return DataType::Bool; // Boolean value of true and false
+        compare_zero(inst.b);
+        emit(Mnemonic::Je, symbol("divzero_error")); // check division by zero
       }
-
-      DataType operator()(const NodeBinExprNeq *neq) const
+      move(Reg::rax, inst.a);
+      emit(Mnemonic::Cqo);             // sign-extend RAX -> RDX:RAX
+      emit(Mnemonic::Idiv, at(inst.b)); // RDX:RAX / divisor -> quotient in RAX, remainder in RDX
+      if (regs.location(id).kind != Location::Kind::None)
       {
-        DataType rhs_type = gen->gen_expr(neq->rhs);
-        DataType lhs_type = gen->gen_expr(neq->lhs);
-
-        if (lhs_type != rhs_type)
-        {
-          std::cerr << "Error: Non Equality comparison requires both operands to be of the same type" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax"); // lhs
-        gen->pop("rbx"); // rhs
-        gen->output << "    cmp rax, rbx\n";
-        gen->output << "    setne al\n";
-        gen->output << "    movzx rax, al\n";
-        gen->push("rax");
-        return DataType::Bool;
+        emit(Mnemonic::Mov, at(id), AsmOperand::reg(info.result));
       }
+      break;
+    }
+    case Lowering::Compare:
+      compare(inst.a, inst.b);
+      emit(info.insn, al);
+      set_from_al(id);
+      break;
+    case Lowering::Logical:
+      compare_zero(inst.a);
+      emit(Mnemonic::Setne, al);
+      compare_zero(inst.b);
+      emit(Mnemonic::Setne, ah);
+      // Bitwise and/or of 0/1 values
+      emit(info.insn, al, ah);
+      set_from_al(id);
+      break;
+    }
+  }
 
-      DataType operator()(const NodeBinExprLt *lt) const
+  // Divides by a constant without idiv (see ConstDivisor), leaving the
+  // quotient in rdx or the remainder in rax. The dividend is never in rdx.
+  void gen_const_divide(ValueId id, int64_t d, const ConstDivisor &by, bool remainder)
+  {
+    // Nothing can fail, so an unused result needs no code.
+    if (regs.location(id).kind == Location::Kind::None)
+      return;
+    const Inst &inst = ir.values[id];
+    const AsmOperand x = at(inst.a);
+    const AsmOperand rdx = AsmOperand::reg(Reg::rdx);
+    switch (by.kind)
+    {
+    case ConstDivisor::Kind::One:
+      if (remainder)
       {
-        DataType rhs_type = gen->gen_expr(lt->rhs);
-        DataType lhs_type = gen->gen_expr(lt->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
-        {
-          std::cerr << "Error: Less Then operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax"); // lhs
-        gen->pop("rbx"); // rhs
-        gen->output << "    cmp rax, rbx\n";
-        gen->output << "    setl al\n";
-        gen->output << "    movzx rax, al\n";
-        gen->push("rax");
-        return DataType::Bool;
+        emit(Mnemonic::Mov, rax, imm(0));
       }
-
-      DataType operator()(const NodeBinExprGt *gt) const
+      else
       {
-        DataType rhs_type = gen->gen_expr(gt->rhs);
-        DataType lhs_type = gen->gen_expr(gt->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
-        {
-          std::cerr << "Error: Greater Then operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax"); // lhs
-        gen->pop("rbx"); // rhs
-        gen->output << "    cmp rax, rbx\n";
-        gen->output << "    setg al\n";
-        gen->output << "    movzx rax, al\n";
-        gen->push("rax");
-        return DataType::Bool;
+        emit(Mnemonic::Mov, rdx, x);
       }
-
-      DataType operator()(const NodeBinExprLte *lte) const
+      break;
+    case ConstDivisor::Kind::PowerOfTwo:
+      // Negative dividends get |d| - 1 added, so the shift rounds toward zero.
+      emit(Mnemonic::Mov, rdx, x);
+      if (by.shift > 1)
       {
-        DataType rhs_type = gen->gen_expr(lte->rhs);
-        DataType lhs_type = gen->gen_expr(lte->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
-        {
-          std::cerr << "Error: Less Then Equal to operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax"); // lhs
-        gen->pop("rbx"); // rhs
-        gen->output << "    cmp rax, rbx\n";
-        gen->output << "    setle al\n";
-        gen->output << "    movzx rax, al\n";
-        gen->push("rax");
-        return DataType::Bool;
+        emit(Mnemonic::Sar, rdx, imm(63));
       }
-
-      DataType operator()(const NodeBinExprGte *gte) const
+      emit(Mnemonic::Shr, rdx, imm(64 - by.shift));
+      emit(Mnemonic::Add, rdx, x);
+      if (remainder)
       {
-        DataType rhs_type = gen->gen_expr(gte->rhs);
-        DataType lhs_type = gen->gen_expr(gte->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
-        {
-          std::cerr << "Error: Greater Then Equal to operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax"); // lhs
-        gen->pop("rbx"); // rhs
-        gen->output << "    cmp rax, rbx\n";
-        gen->output << "    setge al\n";
-        gen->output << "    movzx rax, al\n";
-        gen->push("rax");
-        return DataType::Bool;
+        and_imm(rdx, -(int64_t{1} << by.shift));
+        emit(Mnemonic::Mov, rax, x);
+        emit(Mnemonic::Sub, rax, rdx);
       }
-      DataType operator()(const NodeBinExprAnd *gte) const
+      else
       {
-        DataType rhs_type = gen->gen_expr(gte->rhs);
-        DataType lhs_type = gen->gen_expr(gte->lhs);
-
-        if ((lhs_type != DataType::Int && lhs_type != DataType::Bool) || (rhs_type != DataType::Int && rhs_type != DataType::Bool))
+        emit(Mnemonic::Sar, rdx, imm(by.shift));
+        if (d < 0)
         {
-          std::cerr << "Error: Greater Then Equal to operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
+          emit(Mnemonic::Neg, rdx);
         }
-
-        gen->pop("rax"); // lhs
-        gen->pop("rbx"); // rhs
-
-        gen->output << "    cmp rax, 0\n";
-        gen->output << "    setne al\n";
-        gen->output << "    movzx rax, al\n";
-
-        gen->output << "    cmp rbx, 0\n";
-        gen->output << "    setne bl\n";
-        gen->output << "    movzx rbx, bl\n";
-
-        // Logical AND (bitwise and of 0/1 values)
-        gen->output << "    and rax, rbx\n";
-
-        gen->push("rax");
-        return DataType::Bool;
       }
-      DataType operator()(const NodeBinExprOr *gte) const
+      break;
+    case ConstDivisor::Kind::Magic:
+      // rdx = the high half of x * multiplier
+      if (x.kind == AsmOperand::Kind::Imm)
       {
-        DataType rhs_type = gen->gen_expr(gte->rhs);
-        DataType lhs_type = gen->gen_expr(gte->lhs);
-
-        if (lhs_type != DataType::Int || rhs_type != DataType::Int)
-        {
-          std::cerr << "Error: Greater Then Equal to operator requires both operands to be integers" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->pop("rax"); // lhs
-        gen->pop("rbx"); // rhs
-        gen->output << "    cmp rax, 0\n";
-        gen->output << "    setne al\n";
-        gen->output << "    movzx rax, al\n";
-
-        gen->output << "    cmp rbx, 0\n";
-        gen->output << "    setne bl\n";
-        gen->output << "    movzx rbx, bl\n";
-
-        // Logical OR (bitwise or of 0/1 values)
-        gen->output << "    or rax, rbx\n";
-
-        gen->push("rax");
-        return DataType::Bool;
+        emit(Mnemonic::Mov, rax, x);
+        emit(Mnemonic::Mov, rdx, imm(by.multiplier));
+        emit(Mnemonic::Imul, rdx);
       }
-    };
-    BinExprVisitor visitor(this);
-    return std::visit(visitor, bin_expr->op);
-  }
-
-  DataType gen_expr(const NodeExpr *expr)
-  {
-    struct ExprVisistor
-    {
-      Generator *gen;
-      DataType operator()(const NodeTerm *term) const
+      else
       {
-        return gen->gen_term(term);
+        emit(Mnemonic::Mov, rax, imm(by.multiplier));
+        emit(Mnemonic::Imul, x);
       }
-      DataType operator()(const NodeBinExpr *bin_expr) const
+      if (d > 0 && by.multiplier < 0)
       {
-        return gen->gen_bin_expr(bin_expr);
+        emit(Mnemonic::Add, rdx, x);
       }
-    };
-    ExprVisistor visitor(this);
-    return std::visit(visitor, expr->var);
+      else if (d < 0 && by.multiplier > 0)
+      {
+        emit(Mnemonic::Sub, rdx, x);
+      }
+      if (by.shift > 0)
+      {
+        emit(Mnemonic::Sar, rdx, imm(by.shift));
+      }
+      // Round toward zero: add one to a negative quotient.
+      emit(Mnemonic::Mov, rax, rdx);
+      emit(Mnemonic::Shr, rax, imm(63));
+      emit(Mnemonic::Add, rdx, rax);
+      if (remainder)
+      {
+        if (d >= INT32_MIN && d <= INT32_MAX)
+        {
+          emit(Mnemonic::Imul, rdx, imm(d));
+        }
+        else
+        {
+          emit(Mnemonic::Mov, rax, imm(d));
+          emit(Mnemonic::Imul, rdx, rax);
+        }
+        emit(Mnemonic::Mov, rax, x);
+        emit(Mnemonic::Sub, rax, rdx);
+      }
+      break;
+    case ConstDivisor::Kind::None:
+      break;
+    }
+    emit(Mnemonic::Mov, at(id), remainder ? rax : rdx);
   }
 
-  void gen_scope(const NodeStmtScope *stmt_scope)
+  // and with a constant, which only encodes as an immediate in 32 bits.
+  void and_imm(AsmOperand dst, int64_t mask)
   {
-    enter_scope();
-
-    for (const NodeStmt *stmt_s : stmt_scope->stmts)
+    if (mask >= INT32_MIN)
     {
-      gen_stmt(stmt_s);
+      emit(Mnemonic::And, dst, imm(mask));
+      return;
     }
-    exit_scope();
+    emit(Mnemonic::Mov, rax, imm(mask));
+    emit(Mnemonic::And, dst, rax);
   }
 
-  void gen_exit()
+  // Jumps to `target` when the condition's truth equals `sense`, and falls
+  // through otherwise. Fused !, && and || become jumps around each other;
+  // both sides are always evaluated, but the left one may skip the right.
+  void jump_if(ValueId cond, bool sense, AsmOperand target, uint32_t live)
   {
-    output << "    mov rax, 1\n";
-    output << "    mov rdi, 1\n";
-    output << "    lea rsi, [rsp-1]\n";
-    output << "    mov byte [rsp-1], 10\n";
-    output << "    mov rdx, 1\n";
-    output << "    syscall\n";
-    output << "    mov rax, 60\n";
-    pop("rdi");
-    output << "    syscall\n";
-    is_terminated = true;
-  }
-
-  void gen_if_cont(const NodeStmtIfCont *stmt_if_cont, const std::string &end_label)
-  {
-    struct StmtIfContVisitor
+    struct Frame
     {
-      Generator *gen;
-      const std::string &end_label;
-
-      void operator()(const NodeStmtElif *stmt_elif) const
-      {
-        gen->gen_expr(stmt_elif->expr);
-        gen->pop("rax");
-        std::string label = gen->create_label();
-        gen->output << "    test rax, rax\n";
-        gen->output << "    jz " << label << "\n";
-        gen->gen_scope(stmt_elif->scope);
-        gen->output << "    jmp " << end_label << "\n";
-        if (stmt_elif->cont.has_value())
-        {
-          gen->output << label << ":\n";
-          gen->gen_if_cont(stmt_elif->cont.value(), end_label);
-        }
-      }
-
-      void operator()(const NodeStmtElse *stmt_else) const
-      {
-        gen->gen_scope(stmt_else->scope);
-      }
+      ValueId value;
+      bool sense;
+      AsmOperand target;
+      uint32_t live;
+      std::optional<AsmOperand> place; // a label to place instead
     };
-    StmtIfContVisitor visitor{this, end_label};
-    std::visit(visitor, stmt_if_cont->clause);
-  }
-
-  void gen_stmt(const NodeStmt *stmt)
-  {
-    struct StmtVisitor
+    std::vector<Frame> work = {{cond, sense, target, live, std::nullopt}};
+    while (!work.empty())
     {
-      Generator *gen;
-      void operator()(const NodeStmtExit *stmt_exit) const
+      const Frame frame = work.back();
+      work.pop_back();
+      if (frame.place)
       {
-        gen->gen_expr(stmt_exit->expr);
-        gen->gen_exit();
+        emit(Mnemonic::Label, *frame.place);
+        continue;
       }
-      void operator()(const NodeStmtPrint *stmt_print) const
+      const Inst &inst = ir.values[frame.value];
+      if (!regs.fused(frame.value))
       {
-        DataType dtpye = gen->gen_expr(stmt_print->expr);
-        gen->pop("rdi");
-        switch (dtpye)
-        {
-        case DataType::Int:
-        {
-          gen->output << "    call print_int\n";
-          break;
-        }
-        case DataType::Bool:
-        {
-          gen->output << "    call print_int\n";
-          break;
-        }
-        case DataType::Char:
-        {
-          gen->output << "    call print_char\n";
-          break;
-        }
-
-        default:
-          break;
-        }
+        compare_zero(frame.value);
+        code.push_back({frame.sense ? Mnemonic::Jnz : Mnemonic::Jz, frame.target, {}, frame.live});
+        continue;
       }
-      void operator()(const NodeStmtIf *stmt_if) const
+      switch (inst.op)
       {
-        gen->gen_expr(stmt_if->expr);
-        gen->pop("rax");
-        std::string label = gen->create_label();
-        gen->output << "    test rax, rax\n";
-        gen->output << "    jz " << label << "\n";
-        gen->gen_scope(stmt_if->scope);
-        if (stmt_if->cont.has_value())
+      case Opcode::Not:
+        work.push_back({inst.a, !frame.sense, frame.target, frame.live, std::nullopt});
+        break;
+      case Opcode::And:
+      case Opcode::Or:
+        // Jumping when an && is false or an || is true takes either side;
+        // otherwise the left side can only rule the jump out.
+        if ((inst.op == Opcode::And) != frame.sense)
         {
-          const std::string end_label = gen->create_label();
-          gen->output << "    jmp " << end_label << "\n";
-          gen->output << label << ":\n";
-          gen->gen_if_cont(stmt_if->cont.value(), end_label);
-          gen->output << end_label << ":\n";
+          work.push_back({inst.b, frame.sense, frame.target, frame.live, std::nullopt});
+          work.push_back({inst.a, frame.sense, frame.target, frame.live, std::nullopt});
         }
         else
         {
-          gen->output << label << ":\n";
+          const AsmOperand skip = {AsmOperand::Kind::Label, next_label++};
+          work.push_back({no_value, false, {}, 0, skip});
+          work.push_back({inst.b, frame.sense, frame.target, frame.live, std::nullopt});
+          work.push_back({inst.a, !frame.sense, skip, all_regs, std::nullopt});
         }
-      }
-      void operator()(const NodeStmtConst *stmt_const) const
+        break;
+      default:
       {
-        if (gen->is_declared(stmt_const->ident.val.value()))
-        {
-          std::cerr << "Variable " << stmt_const->ident.val.value() << " already declared" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        DataType expr_type = gen->gen_expr(stmt_const->expr);
-        if (expr_type != stmt_const->dtype)
-        {
-          std::cerr << "Error: Type mismatch for variable '" << stmt_const->ident.val.value()
-                    << "'. Expected " << gen->type_to_string(stmt_const->dtype)
-                    << " but got " << gen->type_to_string(expr_type) << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        gen->declare_var(stmt_const->ident.val.value(), Var(gen->stack_size, stmt_const->dtype));
+        const size_t index = static_cast<size_t>(binary_op(inst.op)) - static_cast<size_t>(BinOp::Eq);
+        compare(inst.a, inst.b);
+        code.push_back({(frame.sense ? jump_if_true : jump_if_false)[index], frame.target, {}, frame.live});
+        break;
       }
-      void operator()(const NodeStmtLet *stmt_let) const
-      {
-        if (gen->is_declared(stmt_let->ident.val.value()))
-        {
-          std::cerr << "Variable " << stmt_let->ident.val.value() << " already declared" << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        if (!stmt_let->expr.has_value())
-        {
-          gen->output << "mov rax, 0\n";
-          gen->push("rax");
-        }
-        else
-        {
-          DataType expr_type = gen->gen_expr(stmt_let->expr.value());
-          if (expr_type != stmt_let->dtype)
-          {
-            std::cerr << "Error: Type mismatch for variable '" << stmt_let->ident.val.value()
-                      << "'. Expected " << gen->type_to_string(stmt_let->dtype)
-                      << " but got " << gen->type_to_string(expr_type) << std::endl;
-            exit(EXIT_FAILURE);
-          }
-        }
-        gen->declare_var(stmt_let->ident.val.value(), Var(gen->stack_size, stmt_let->dtype, true));
       }
-      void operator()(const NodeStmtAssign *stmt_assign)
-      {
-        if (!stmt_assign->ident.val.has_value())
-        {
-          std::cerr << "Error: Assignment statement missing identifier." << std::endl;
-          exit(EXIT_FAILURE);
-        }
-        if (!gen->globals.contains(stmt_assign->ident.val.value()))
-        {
-          std::cerr << "You need to declare the variable first";
-          exit(EXIT_FAILURE);
-        }
-        auto &existing_var = gen->globals.at(stmt_assign->ident.val.value());
-        if (!existing_var.mut)
-        {
-          std::cerr << "Error: Cannot assign to immutable variable '"
-                    << stmt_assign->ident.val.value() << "'\n";
-          exit(EXIT_FAILURE);
-        }
-        DataType type = gen->gen_expr(stmt_assign->expr);
-        if (type != existing_var.dtype)
-        {
-          std::cerr << "Error: Type mismatch in assignment to '"
-                    << stmt_assign->ident.val.value() << "'. Expected "
-                    << gen->type_to_string(existing_var.dtype)
-                    << ", got " << gen->type_to_string(type) << "\n";
-          exit(EXIT_FAILURE);
-        }
-        const auto new_var = Var(gen->stack_size, type, true);
-        gen->update_var(stmt_assign->ident.val.value(), existing_var, new_var);
-      }
-      void operator()(const NodeStmtScope *stmt_scope) const
-      {
-        gen->gen_scope(stmt_scope);
-      }
-    };
-    StmtVisitor visitor{this};
-    std::visit(visitor, stmt->stmt);
+    }
   }
 
-  std::string gen_prog()
+  // Writes a newline, then exits with the value. The code is kept on the
+  // stack while the write syscall clobbers registers.
+  void gen_exit(ValueId code)
   {
+    emit(Mnemonic::Push, at(code));
+    emit(Mnemonic::Mov, rax, imm(1));
+    emit(Mnemonic::Mov, AsmOperand::reg(Reg::rdi), imm(1));
+    emit(Mnemonic::Lea, AsmOperand::reg(Reg::rsi), {AsmOperand::Kind::Addr, -1});
+    emit(Mnemonic::Mov, {AsmOperand::Kind::ByteMem, -1}, imm(10));
+    emit(Mnemonic::Mov, AsmOperand::reg(Reg::rdx), imm(1));
+    emit(Mnemonic::Syscall);
+    emit(Mnemonic::Mov, rax, imm(60));
+    emit(Mnemonic::Pop, AsmOperand::reg(Reg::rdi));
+    emit(Mnemonic::Syscall);
+  }
 
-    output << "extern print_int\n"
-           << "extern print_string\n"
-           << "extern print_char\n"
-           << "extern overflow_error\n"
-           << "extern divzero_error\n"
-           << "global _start\n"
-           << "_start:\n";
-
-    for (const NodeStmt *stmt : prog.stmts)
+  // A phi is live from the end of its first predecessor and its arguments
+  // until the end of theirs, so no phi shares a location with an argument
+  // and the copies can be made one after another.
+  void gen_phi_copies(BlockId from, BlockId to)
+  {
+    const Block &target = ir.blocks[to];
+    const size_t index = std::find(target.preds.begin(), target.preds.end(), from) - target.preds.begin();
+    for (ValueId value : target.insts)
     {
-      if (is_terminated)
-        return output.str();
-      gen_stmt(stmt);
+      if (ir.values[value].op != Opcode::Phi)
+        break;
+      const Location dst = regs.location(value);
+      if (dst.kind == Location::Kind::Reg)
+      {
+        move(static_cast<Reg>(dst.index), ir.args(value)[index]);
+      }
+      else if (dst.kind == Location::Kind::Slot)
+      {
+        move(Reg::rax, ir.args(value)[index]);
+        emit(Mnemonic::Mov, at(value), rax);
+      }
     }
-
-    gen_exit();
-
-    return output.str();
   }
 
-private:
-  struct Var
+  void emit(Mnemonic op, AsmOperand dst = {}, AsmOperand src = {})
   {
-    size_t stack_loc;
-    DataType dtype;
-    bool mut;
-    Var() : stack_loc(0), dtype(DataType::Int), mut(false) {}
-    Var(size_t stack_loc, DataType dtype, bool mut = false)
-        : stack_loc(stack_loc), dtype(dtype), mut(mut) {}
-  };
+    code.push_back({op, dst, src});
+  }
 
-  struct ScopeEntry
+  AsmOperand at(ValueId value) const
   {
-    std::string name;
-    std::optional<Var> old_binding; // empty if no shadowing
-  };
+    const Location loc = regs.location(value);
+    switch (loc.kind)
+    {
+    case Location::Kind::Reg:
+      return AsmOperand::reg(static_cast<Reg>(loc.index));
+    case Location::Kind::Slot:
+      return {AsmOperand::Kind::Slot, loc.index * 8};
+    case Location::Kind::Imm:
+      return imm(ir.values[value].imm);
+    default:
+      return {};
+    }
+  }
 
-  void push(const std::string &reg)
+  void move(Reg reg, ValueId value)
   {
-    output << "    push " << reg << "\n";
-    stack_size++;
+    const Location src = regs.location(value);
+    if (src.kind == Location::Kind::Reg && src.index == static_cast<uint32_t>(reg))
+      return;
+    emit(Mnemonic::Mov, AsmOperand::reg(reg), at(value));
   }
-  void pop(const std::string &reg)
+
+  // Sets the flags from comparing lhs with rhs. cmp takes a register or
+  // memory first, and at most one memory operand.
+  void compare(ValueId lhs, ValueId rhs)
   {
-    output << "    pop " << reg << "\n";
-    stack_size--;
+    const Location::Kind a = regs.location(lhs).kind;
+    const Location::Kind b = regs.location(rhs).kind;
+    if (a == Location::Kind::Reg || (a == Location::Kind::Slot && b != Location::Kind::Slot))
+    {
+      emit(Mnemonic::Cmp, at(lhs), at(rhs));
+    }
+    else
+    {
+      move(Reg::rax, lhs);
+      emit(Mnemonic::Cmp, rax, at(rhs));
+    }
   }
-  std::string create_label()
+
+  // Sets the flags from comparing the value with zero.
+  void compare_zero(ValueId value)
   {
-    std::stringstream ss;
-    ss << "label" << label_count++;
-    return ss.str();
+    if (regs.location(value).kind == Location::Kind::Reg)
+    {
+      emit(Mnemonic::Test, at(value), at(value));
+    }
+    else
+    {
+      emit(Mnemonic::Cmp, at(value), imm(0));
+    }
   }
 
-  void enter_scope()
+  // The register to compute a result in: its own, or rax.
+  Reg result_reg(ValueId value) const
   {
-    scopes.push_back({});
+    const Location loc = regs.location(value);
+    return loc.kind == Location::Kind::Reg ? static_cast<Reg>(loc.index) : Reg::rax;
   }
 
-  void exit_scope()
+  // Stores a result computed in rax to its frame slot.
+  void store_result(ValueId value)
   {
-    for (auto &entry : scopes.back())
+    if (regs.location(value).kind == Location::Kind::Slot)
     {
-      if (entry.old_binding.has_value())
-      {
-        // Restore the old value (either from shadowing or from assignment)
-        globals[entry.name] = entry.old_binding.value();
-      }
-      else
-      {
-        // Variable was new, remove it
-        globals.erase(entry.name);
-      }
+      emit(Mnemonic::Mov, at(value), rax);
     }
-    scopes.pop_back();
   }
 
-  void update_var(const std::string &name, Var &old_var, Var new_var)
+  // Zero-extends a 0/1 result in al into the value's location.
+  void set_from_al(ValueId value)
   {
-    // Save the current state before modifying
-    if (!scopes.empty())
+    const Location loc = regs.location(value);
+    if (loc.kind == Location::Kind::Reg)
     {
-      scopes.back().push_back({name, old_var});
+      emit(Mnemonic::Movzx, at(value), al);
+    }
+    else if (loc.kind == Location::Kind::Slot)
+    {
+      emit(Mnemonic::Movzx, rax, al);
+      emit(Mnemonic::Mov, at(value), rax);
     }
-
-    // Now update the variable
-    old_var = new_var;
   }
 
-  void declare_var(const std::string &name, Var var)
+  bool is_const(ValueId value, int64_t constant) const
   {
-    std::optional<Var> old_binding;
-    if (globals.contains(name))
-    {
-      old_binding = globals[name];
-    }
+    return ir.values[value].op == Opcode::Const && ir.values[value].imm == constant;
+  }
 
-    globals[name] = var;
+  // k when the value is the constant 2^k for some k > 0, else 0.
+  int log2_of(ValueId value) const
+  {
+    const Inst &inst = ir.values[value];
+    if (inst.op != Opcode::Const || inst.imm < 2 || !std::has_single_bit(static_cast<uint64_t>(inst.imm)))
+      return 0;
+    return std::countr_zero(static_cast<uint64_t>(inst.imm));
+  }
 
-    if (scopes.empty())
-    {
-      scopes.push_back({});
-    }
-    scopes.back().push_back({name, old_binding});
+  static AsmOperand imm(int64_t value)
+  {
+    return {AsmOperand::Kind::Imm, value};
   }
 
-  bool is_declared(const std::string &name) const
+  static AsmOperand label(BlockId block)
   {
-    if (scopes.empty())
-      return false;
-    for (auto &entry : scopes.back())
-    {
-      if (entry.name == name)
-      {
-        return true; // declared in this scope
-      }
-    }
-    return false;
+    return {AsmOperand::Kind::Label, block};
   }
 
-  std::string type_to_string(DataType type) const
+  static AsmOperand symbol(const char *name)
   {
-    switch (type)
-    {
-    case DataType::Int:
-      return "int";
-    case DataType::Char:
-      return "char";
-    default:
-      return "unknown";
-    }
+    return {AsmOperand::Kind::Symbol, 0, name};
   }
 
-  bool is_terminated = false;
-  std::stringstream output;
-  const NodeProg prog;
-  size_t stack_size = 0;
-  int label_count = 0;
-  std::unordered_map<std::string, Var> globals{};
-  std::vector<std::vector<ScopeEntry>> scopes;
-};
\ No newline at end of file
+  static constexpr AsmOperand rax = {AsmOperand::Kind::Reg, static_cast<int64_t>(Reg::rax)};
+  static constexpr AsmOperand al = {AsmOperand::Kind::Byte, 0};
+  static constexpr AsmOperand ah = {AsmOperand::Kind::Byte, 1};
+
+  std::vector<AsmInst> code;
+  const Ir &ir;
+  const RegAlloc &regs;
+  const RangeAnalysis &ranges;
+  uint32_t next_label; // labels past the blocks' own, for jumps within a condition
+};
@@ -0,0 +1,198 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "./parser.hpp"
+
+// Keeps the top-level statements of a changing source file parsed.
+//
+// Each top-level statement is a unit that remembers the byte range of its
+// tokens and its AST. update() diffs the new text against the previous one
+// (common prefix and suffix) and re-lexes from just after the last token
+// that precedes the edit. Lexing stops at the first statement boundary that
+// lines up with an untouched unit behind the edit. Only the statements in
+// between are parsed again; later units are kept, with their byte ranges
+// shifted by the change in length.
+//
+// Every partial re-parse allocates into a fresh Parser arena, which stays
+// alive while its statements may be in use. After max_generations updates
+// the whole file is re-parsed so that stale nodes are released.
+class IncrementalParser
+{
+public:
+  static constexpr size_t max_generations = 64;
+
+  struct Stats
+  {
+    size_t reused = 0;   // statements kept from the previous parse
+    size_t reparsed = 0; // statements parsed again
+    size_t relexed_bytes = 0;
+  };
+
+  explicit IncrementalParser(Interner &symbols) : m_interner(symbols) {}
+
+  IncrementalParser(const IncrementalParser &other) = delete;
+
+  IncrementalParser &operator=(const IncrementalParser &other) = delete;
+
+  void update(std::string contents)
+  {
+    const std::string old = std::move(m_source);
+    m_source = std::move(contents);
+    const std::string_view src = m_source;
+    if (src.size() > UINT32_MAX)
+    {
+      std::cerr << "Source file too large\n";
+      std::exit(EXIT_FAILURE);
+    }
+
+    const bool full = m_generations.size() >= max_generations;
+    if (full)
+    {
+      m_units.clear();
+    }
+
+    const size_t limit = std::min(old.size(), src.size());
+    const size_t prefix = std::mismatch(old.begin(), old.begin() + limit, src.begin()).first - old.begin();
+    size_t suffix = 0;
+    while (suffix < limit - prefix && old[old.size() - 1 - suffix] == src[src.size() - 1 - suffix])
+    {
+      suffix++;
+    }
+    const size_t old_edit_end = old.size() - suffix;
+    const int64_t delta = static_cast<int64_t>(src.size()) - static_cast<int64_t>(old.size());
+
+    // The first unit the edit can touch is the first one ending at or after
+    // the edit start. The unit before it is redone too, so an elif/else
+    // typed after an if joins that if statement.
+    size_t first = std::partition_point(m_units.begin(), m_units.end(), [prefix](const Unit &unit)
+                                        { return unit.end < prefix; }) -
+                   m_units.begin();
+    first = first > 0 ? first - 1 : 0;
+    const size_t relex_from = first > 0 ? m_units[first - 1].end : 0;
+
+    // Units starting behind the edit can be reused once the lexer reaches a
+    // statement boundary exactly at their (shifted) start.
+    size_t next = std::partition_point(m_units.begin(), m_units.end(), [old_edit_end](const Unit &unit)
+                                       { return unit.begin < old_edit_end; }) -
+                  m_units.begin();
+    size_t resume = m_units.size();
+
+    auto generation = std::make_unique<Generation>();
+    std::vector<size_t> starts;
+    Tokeniser lexer(src, m_interner);
+    lexer.seek(relex_from);
+    StatementBoundaries boundaries;
+    while (auto token = lexer.next())
+    {
+      if (boundaries.starts_statement(token->type))
+      {
+        while (next < m_units.size() && m_units[next].begin + delta < token->offset)
+        {
+          next++;
+        }
+        if (next < m_units.size() && m_units[next].begin + delta == token->offset)
+        {
+          resume = next;
+          break;
+        }
+        starts.push_back(generation->tokens.size());
+      }
+      generation->tokens.push_back(token.value());
+    }
+
+    m_stats.relexed_bytes = (resume < m_units.size() ? m_units[resume].begin + delta : src.size()) - relex_from;
+    m_stats.reparsed = starts.size();
+
+    std::vector<Unit> fresh;
+    if (!generation->tokens.empty())
+    {
+      const std::vector<Token> &tokens = generation->tokens;
+      generation->source = std::make_unique<SpanTokenSource>(tokens);
+      generation->parser = std::make_unique<Parser>(*generation->source);
+      const NodeProg part = generation->parser->parse();
+      if (part.stmts.size() != starts.size())
+      {
+        std::cerr << "Internal error: statement boundaries do not match the parse\n";
+        std::exit(EXIT_FAILURE);
+      }
+      fresh.reserve(starts.size());
+      for (size_t i = 0; i < starts.size(); i++)
+      {
+        const Token &last = tokens[(i + 1 < starts.size() ? starts[i + 1] : tokens.size()) - 1];
+        fresh.push_back({tokens[starts[i]].offset, last.offset + last.length, part.stmts[i]});
+      }
+    }
+    if (full)
+    {
+      m_generations.clear();
+    }
+    if (generation->parser != nullptr)
+    {
+      m_generations.push_back(std::move(generation));
+    }
+
+    for (size_t i = resume; i < m_units.size(); i++)
+    {
+      m_units[i].begin += delta;
+      m_units[i].end += delta;
+    }
+    m_units.erase(m_units.begin() + first, m_units.begin() + resume);
+    m_units.insert(m_units.begin() + first, fresh.begin(), fresh.end());
+    m_stats.reused = m_units.size() - fresh.size();
+  }
+
+  // The current program. The statements stay valid until the next update().
+  NodeProg program() const
+  {
+    NodeProg prog{std::pmr::vector<NodeStmt *>(std::pmr::get_default_resource())};
+    prog.stmts.reserve(m_units.size());
+    for (const Unit &unit : m_units)
+    {
+      prog.stmts.push_back(unit.stmt);
+    }
+    return prog;
+  }
+
+  // Work done by the last update().
+  const Stats &stats() const
+  {
+    return m_stats;
+  }
+
+  ArenaAllocator::Stats arena_stats() const
+  {
+    ArenaAllocator::Stats total;
+    for (const std::unique_ptr<Generation> &generation : m_generations)
+    {
+      total += generation->parser->arena().stats();
+    }
+    return total;
+  }
+
+private:
+  struct Unit
+  {
+    uint32_t begin; // offset of the first token
+    uint32_t end;   // offset just past the last token
+    NodeStmt *stmt;
+  };
+
+  // The tokens and parser (with its arena) of one re-parse.
+  struct Generation
+  {
+    std::vector<Token> tokens;
+    std::unique_ptr<SpanTokenSource> source;
+    std::unique_ptr<Parser> parser;
+  };
+
+  Interner &m_interner;
+  std::string m_source;
+  std::vector<Unit> m_units;
+  std::vector<std::unique_ptr<Generation>> m_generations;
+  Stats m_stats;
+};
@@ -0,0 +1,47 @@
+#pragma once
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using SymbolId = uint32_t;
+
+// Maps each distinct identifier to a dense SymbolId at lex time. Everything
+// after the tokeniser (parser, generator symbol tables) works with ids, and
+// the spelling is only looked up again for diagnostics. Interned names are
+// owned by the interner, so they stay valid independently of the source.
+class Interner
+{
+public:
+  inline SymbolId intern(std::string_view name)
+  {
+    auto it = m_ids.find(name);
+    if (it != m_ids.end())
+    {
+      return it->second;
+    }
+    const std::string &stored = m_storage.emplace_back(name);
+    const auto id = static_cast<SymbolId>(m_names.size());
+    m_names.push_back(stored);
+    m_ids.emplace(stored, id);
+    return id;
+  }
+
+  inline std::string_view name(SymbolId id) const
+  {
+    return m_names[id];
+  }
+
+  inline size_t size() const
+  {
+    return m_names.size();
+  }
+
+private:
+  // std::deque never relocates its elements, so views into them stay valid.
+  std::deque<std::string> m_storage;
+  std::vector<std::string_view> m_names;
+  std::unordered_map<std::string_view, SymbolId> m_ids;
+};
@@ -0,0 +1,231 @@
+#pragma once
+#include <cstdint>
+#include <span>
+#include <vector>
+#include "./flatAst.hpp"
+
+// Typed mid-level IR in SSA form, sitting between the FlatAst and the x86-64
+// emitter.
+//
+// Every instruction lives in one function-wide pool and its index doubles as
+// the id of the value it produces, so operands are plain 32-bit ids. Blocks
+// list their instructions in execution order: phis first, then ordinary
+// instructions, then exactly one terminator (Jump, Branch or Exit). The
+// language has no loops, so the CFG is acyclic, and blocks are created in an
+// order where every block comes after all of its predecessors. That order is
+// also the code layout, and analyses can visit blocks in a single forward
+// sweep.
+//
+// A phi has one argument per predecessor, in the order of Block::preds.
+// Branch targets never start with phis: the builder gives each side of an if
+// or of a short-circuit && or || its own block, so phi copies always sit at
+// the end of a block ending in a Jump.
+
+using ValueId = uint32_t;
+using BlockId = uint32_t;
+inline constexpr ValueId no_value = UINT32_MAX;
+inline constexpr BlockId no_block = UINT32_MAX;
+
+enum class Opcode : uint8_t
+{
+  Const, // imm
+  Argc,  // the process argument count
+  Neg,   // a
+  Not,   // a
+  Add,   // a, b; the binary opcodes are laid out in BinOp order
+  Sub,
+  Mul,
+  Div,
+  Mod,
+  Eq,
+  Neq,
+  Lt,
+  Gt,
+  Lte,
+  Gte,
+  And,
+  Or,
+  Phi,    // arguments in Ir::phi_args, starting at imm
+  Print,  // a; prints as a char when its type is Char
+  Jump,   // to succ[0]
+  Branch, // a; to succ[0] when non-zero, else succ[1]
+  Exit,   // a
+};
+
+inline constexpr Opcode binary_opcode(BinOp op)
+{
+  return static_cast<Opcode>(static_cast<uint8_t>(Opcode::Add) + static_cast<uint8_t>(op));
+}
+
+inline constexpr BinOp binary_op(Opcode op)
+{
+  return static_cast<BinOp>(static_cast<uint8_t>(op) - static_cast<uint8_t>(Opcode::Add));
+}
+
+inline constexpr bool is_binary(Opcode op)
+{
+  return op >= Opcode::Add && op <= Opcode::Or;
+}
+
+inline constexpr bool is_terminator(Opcode op)
+{
+  return op >= Opcode::Jump;
+}
+
+static_assert(binary_opcode(BinOp::Mod) == Opcode::Mod && binary_opcode(BinOp::Or) == Opcode::Or);
+
+struct Inst
+{
+  Opcode op;
+  DataType type; // type of the result
+  ValueId a = no_value;
+  ValueId b = no_value;
+  int64_t imm = 0;
+  BlockId block = no_block; // no_block once the instruction is removed
+};
+
+struct Block
+{
+  std::vector<ValueId> insts;
+  std::vector<BlockId> preds;
+  BlockId succ[2] = {no_block, no_block};
+  bool removed = false;
+};
+
+class Ir
+{
+public:
+  std::vector<Inst> values;
+  std::vector<Block> blocks;
+  std::vector<ValueId> phi_args;
+
+  BlockId add_block()
+  {
+    blocks.emplace_back();
+    return static_cast<BlockId>(blocks.size() - 1);
+  }
+
+  ValueId append(BlockId block, Opcode op, DataType type, ValueId a = no_value, ValueId b = no_value, int64_t imm = 0)
+  {
+    values.push_back({op, type, a, b, imm, block});
+    const auto id = static_cast<ValueId>(values.size() - 1);
+    blocks[block].insts.push_back(id);
+    return id;
+  }
+
+  // Adds a phi after the block's existing phis. `args` follow Block::preds.
+  ValueId add_phi(BlockId block, DataType type, std::span<const ValueId> args)
+  {
+    const auto first = static_cast<int64_t>(phi_args.size());
+    phi_args.insert(phi_args.end(), args.begin(), args.end());
+    values.push_back({Opcode::Phi, type, no_value, no_value, first, block});
+    const auto id = static_cast<ValueId>(values.size() - 1);
+    std::vector<ValueId> &insts = blocks[block].insts;
+    auto pos = insts.begin();
+    while (pos != insts.end() && values[*pos].op == Opcode::Phi)
+    {
+      pos++;
+    }
+    insts.insert(pos, id);
+    return id;
+  }
+
+  std::span<ValueId> args(ValueId phi)
+  {
+    return std::span(phi_args).subspan(values[phi].imm, blocks[values[phi].block].preds.size());
+  }
+
+  std::span<const ValueId> args(ValueId phi) const
+  {
+    return std::span(phi_args).subspan(values[phi].imm, blocks[values[phi].block].preds.size());
+  }
+
+  void jump(BlockId from, BlockId to)
+  {
+    append(from, Opcode::Jump, DataType::Int);
+    set_succ(from, 0, to);
+  }
+
+  // The targets are set with set_succ(), once they exist.
+  void branch(BlockId from, ValueId cond)
+  {
+    append(from, Opcode::Branch, DataType::Int, cond);
+  }
+
+  void set_succ(BlockId from, int index, BlockId to)
+  {
+    blocks[from].succ[index] = to;
+    blocks[to].preds.push_back(from);
+  }
+
+  ValueId terminator(BlockId block) const
+  {
+    return blocks[block].insts.back();
+  }
+
+  // Calls `f` with every value the instruction reads.
+  template <typename F>
+  void for_each_operand(ValueId id, F &&f) const
+  {
+    const Inst &inst = values[id];
+    if (inst.op == Opcode::Phi)
+    {
+      for (ValueId arg : args(id))
+      {
+        f(arg);
+      }
+      return;
+    }
+    if (inst.a != no_value)
+    {
+      f(inst.a);
+    }
+    if (inst.b != no_value)
+    {
+      f(inst.b);
+    }
+  }
+
+  // Whether removing an unused instruction could change behaviour: output,
+  // control flow, and the runtime overflow and division checks.
+  bool has_side_effects(ValueId id) const
+  {
+    switch (values[id].op)
+    {
+    case Opcode::Add:
+    case Opcode::Sub:
+    case Opcode::Mul:
+    case Opcode::Print:
+      return true;
+    case Opcode::Div:
+    case Opcode::Mod:
+    {
+      // Only a zero divisor, or -1 with INT64_MIN, can fail.
+      const Inst &divisor = values[values[id].b];
+      return divisor.op != Opcode::Const || divisor.imm == 0 || divisor.imm == -1;
+    }
+    default:
+      return is_terminator(values[id].op);
+    }
+  }
+
+  size_t live_value_count() const
+  {
+    size_t count = 0;
+    for (const Block &block : blocks)
+    {
+      count += block.insts.size();
+    }
+    return count;
+  }
+
+  size_t live_block_count() const
+  {
+    size_t count = 0;
+    for (const Block &block : blocks)
+    {
+      count += block.removed ? 0 : 1;
+    }
+    return count;
+  }
+};
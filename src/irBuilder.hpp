@@ -0,0 +1,933 @@
+#pragma once
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "./ir.hpp"
+#include "./constFold.hpp"
+#include "./symbolTable.hpp"
+
+// Lowers a FlatAst into the SSA IR, type-checking the program on the way.
+//
+// Variables get no storage. Each declaration gets an index, and current[]
+// maps it to the value the variable holds at the point being lowered, so an
+// assignment only rebinds that entry. Every rebinding is also written to an
+// undo log. After each side of an if, the log restores the bindings from
+// before the if, and at the join a phi merges each outer variable whose
+// value differs between the two sides.
+//
+// The original stack machine exited, when it ran off the end, with whatever
+// it had pushed last: the value of the last let, const or assignment that
+// ran, at any depth, since scopes never popped their slots; or argc when
+// nothing had been pushed. That value is tracked as a hidden variable
+// (stack_top) so it goes through the undo log and the phis like any other.
+//
+// An && or || whose right operand can fail at run time short-circuits: the
+// left operand is branched on, and the right one is lowered into a block of
+// its own that only runs when the left one doesn't decide the result. Other
+// && and || evaluate both sides, which is cheaper and can't be told apart.
+class IrBuilder
+{
+public:
+  IrBuilder(const FlatAst &program, const Interner &symbols) : ast(program), interner(symbols) {}
+
+  Ir build()
+  {
+    block = ir.add_block();
+    // Top-level declarations live in an outermost scope that is never exited.
+    symbols.enter_scope();
+    current.push_back(ir.append(block, Opcode::Argc, DataType::Int));
+    seen.push_back(0);
+    other.push_back(no_value);
+
+    // Code after a top-level exit is unreachable and is not checked. An exit
+    // nested in a scope or branch may not run, so the statements after it are
+    // still lowered, into blocks without predecessors.
+    for (NodeId stmt : ast.program())
+    {
+      lower_stmt(stmt);
+      if (ast.stmt(stmt).kind == StmtKind::Exit)
+        return std::move(ir);
+    }
+
+    ir.append(open_block(), Opcode::Exit, DataType::Int, current[stack_top]);
+    return std::move(ir);
+  }
+
+private:
+  static constexpr uint32_t stack_top = 0; // index in current[] of the hidden stack-top variable
+
+  struct Var
+  {
+    uint32_t index; // into current[]
+    DataType dtype;
+    bool mut;
+  };
+
+  // One rebinding of a variable, with the value it replaced.
+  struct Write
+  {
+    uint32_t index;
+    ValueId value;
+  };
+
+  struct ExprFrame
+  {
+    NodeId id;
+    uint8_t visits; // 0 when first seen, then one more per lowered operand
+  };
+
+  // A short-circuit && or || whose right operand is being lowered.
+  struct ShortCircuit
+  {
+    BlockId head; // ends in the branch on the left operand
+    bool in_const;
+  };
+
+  // A branch edge whose target is not known yet.
+  struct Edge
+  {
+    BlockId from;
+    int index;
+  };
+
+  // A condition lowered as control flow, by the edges it leaves on.
+  struct Condition
+  {
+    std::vector<Edge> on_true;
+    std::vector<Edge> on_false;
+    DataType type;
+  };
+
+  enum class OperandRule : uint8_t
+  {
+    Int,       // both operands int
+    IntOrBool, // each operand int or bool
+    SameType,  // both operands of one type
+  };
+
+  struct BinOpInfo
+  {
+    const char *name;
+    OperandRule operands;
+    DataType result;
+    bool rhs_first; // evaluate the right operand first
+  };
+
+  // Indexed by BinOp. When both operands can fail at run time, the
+  // evaluation order decides which error is raised, so it matches the
+  // original stack machine. A short-circuit && or || always evaluates its
+  // left operand first.
+  static constexpr BinOpInfo bin_ops[] = {
+      {"Addition operator", OperandRule::Int, DataType::Int, false},
+      {"Subtraction operator", OperandRule::Int, DataType::Int, true},
+      {"Multiplication operator", OperandRule::Int, DataType::Int, false},
+      {"Division operator", OperandRule::Int, DataType::Int, true},
+      {"Modulo operator", OperandRule::Int, DataType::Int, true},
+      {"Equality comparison", OperandRule::SameType, DataType::Bool, true},
+      {"Non Equality comparison", OperandRule::SameType, DataType::Bool, true},
+      {"Less Then operator", OperandRule::Int, DataType::Bool, true},
+      {"Greater Then operator", OperandRule::Int, DataType::Bool, true},
+      {"Less Then Equal to operator", OperandRule::Int, DataType::Bool, true},
+      {"Greater Then Equal to operator", OperandRule::Int, DataType::Bool, true},
+      {"Logical AND operator", OperandRule::IntOrBool, DataType::Bool, true},
+      {"Logical OR operator", OperandRule::IntOrBool, DataType::Bool, true},
+  };
+  static_assert(std::size(bin_ops) == static_cast<size_t>(BinOp::Or) + 1);
+
+  static void check_operands(const BinOpInfo &info, DataType lhs, DataType rhs)
+  {
+    switch (info.operands)
+    {
+    case OperandRule::Int:
+      if (lhs == DataType::Int && rhs == DataType::Int)
+        return;
+      std::cerr << "Error: " << info.name << " requires both operands to be integers" << std::endl;
+      break;
+    case OperandRule::IntOrBool:
+      if ((lhs == DataType::Int || lhs == DataType::Bool) && (rhs == DataType::Int || rhs == DataType::Bool))
+        return;
+      std::cerr << "Error: " << info.name << " requires both operands to be integers or booleans" << std::endl;
+      break;
+    case OperandRule::SameType:
+      if (lhs == rhs)
+        return;
+      std::cerr << "Error: " << info.name << " requires both operands to be of the same type" << std::endl;
+      break;
+    }
+    exit(EXIT_FAILURE);
+  }
+
+  // Returns the block being filled, starting a new one without predecessors
+  // if the last one already ended in an exit.
+  BlockId open_block()
+  {
+    if (terminated)
+    {
+      block = ir.add_block();
+      terminated = false;
+    }
+    return block;
+  }
+
+  // Lowers the expression with an explicit work stack rather than recursion:
+  // an operator node is visited once to schedule its operands and again,
+  // after they have been lowered, to append itself. Operands are lowered in
+  // the fixed order so that compile errors come out as before; schedule()
+  // then reorders the instructions. A short-circuit && or || lowers its left
+  // operand first, so a subtree containing one is type-checked beforehand.
+  ValueId lower_expr(NodeId root)
+  {
+    number_subtree(root);
+    if (branches[root])
+    {
+      check_types(root);
+    }
+    work.clear();
+    operands.clear();
+    work.push_back({root, 0});
+    while (!work.empty())
+    {
+      const ExprFrame frame = work.back();
+      work.pop_back();
+      const FlatAst::Expr expr = ast.expr(frame.id);
+      if (expr.kind == ExprKind::Negate || expr.kind == ExprKind::Not)
+      {
+        if (frame.visits == 0)
+        {
+          work.push_back({frame.id, 1});
+          work.push_back({expr.operand(), 0});
+        }
+        else
+        {
+          operands.back() = lower_unary(expr.kind, operands.back());
+          node_values[frame.id] = operands.back();
+        }
+      }
+      else if (short_circuits(frame.id))
+      {
+        // Visited once more in between, to branch on the left operand.
+        if (frame.visits < 2)
+        {
+          work.push_back({frame.id, static_cast<uint8_t>(frame.visits + 1)});
+          if (frame.visits == 1)
+          {
+            start_rhs(frame.id, operands.back());
+          }
+          work.push_back({frame.visits == 0 ? expr.lhs() : expr.rhs(), 0});
+        }
+        else
+        {
+          const ValueId rhs = operands.back();
+          operands.pop_back();
+          operands.back() = join_rhs(frame.id, operands.back(), rhs);
+          node_values[frame.id] = operands.back();
+        }
+      }
+      else if (is_binary(expr.kind))
+      {
+        const BinOpInfo &info = bin_ops[static_cast<size_t>(expr.op())];
+        if (frame.visits == 0)
+        {
+          // The operand to evaluate first goes on the work stack last.
+          work.push_back({frame.id, 1});
+          work.push_back({info.rhs_first ? expr.lhs() : expr.rhs(), 0});
+          work.push_back({info.rhs_first ? expr.rhs() : expr.lhs(), 0});
+        }
+        else
+        {
+          const ValueId second = operands.back();
+          operands.pop_back();
+          const ValueId first = operands.back();
+          const ValueId lhs = info.rhs_first ? second : first;
+          const ValueId rhs = info.rhs_first ? first : second;
+          check_operands(info, type_of(lhs), type_of(rhs));
+          operands.back() = append_folded(binary_opcode(expr.op()), info.result, lhs, rhs);
+          node_values[frame.id] = operands.back();
+        }
+      }
+      else
+      {
+        operands.push_back(lower_leaf(expr));
+        node_values[frame.id] = operands.back();
+      }
+    }
+    const ValueId result = operands.back();
+    schedule(root);
+    return result;
+  }
+
+  // Reports the first type error in the subtree, walking it in the fixed
+  // operand order like lower_expr() does for operators that don't branch.
+  void check_types(NodeId root)
+  {
+    std::vector<ExprFrame> frames = {{root, 0}};
+    std::vector<DataType> types;
+    while (!frames.empty())
+    {
+      const ExprFrame frame = frames.back();
+      frames.pop_back();
+      const FlatAst::Expr expr = ast.expr(frame.id);
+      if (expr.kind == ExprKind::Negate || expr.kind == ExprKind::Not)
+      {
+        if (frame.visits == 0)
+        {
+          frames.push_back({frame.id, 1});
+          frames.push_back({expr.operand(), 0});
+        }
+        else
+        {
+          types.back() = unary_type(expr.kind, types.back());
+        }
+      }
+      else if (is_binary(expr.kind))
+      {
+        const BinOpInfo &info = bin_ops[static_cast<size_t>(expr.op())];
+        if (frame.visits == 0)
+        {
+          frames.push_back({frame.id, 1});
+          frames.push_back({info.rhs_first ? expr.lhs() : expr.rhs(), 0});
+          frames.push_back({info.rhs_first ? expr.rhs() : expr.lhs(), 0});
+        }
+        else
+        {
+          const DataType second = types.back();
+          types.pop_back();
+          const DataType first = types.back();
+          check_operands(info, info.rhs_first ? second : first, info.rhs_first ? first : second);
+          types.back() = info.result;
+        }
+      }
+      else
+      {
+        types.push_back(leaf_type(expr));
+      }
+    }
+  }
+
+  // Ends the block with a branch on the left operand of a short-circuit
+  // && or || and starts a block for the right one. When the left operand is
+  // a constant that decides the result, the right one never runs, so it
+  // can't make a const initialiser fail.
+  void start_rhs(NodeId id, ValueId lhs)
+  {
+    const FlatAst::Expr expr = ast.expr(id);
+    const bool is_and = expr.kind == ExprKind::And;
+    schedule(expr.lhs());
+    const BlockId head = open_block();
+    const BlockId rhs_block = ir.add_block();
+    ir.branch(head, lhs);
+    ir.set_succ(head, is_and ? 0 : 1, rhs_block);
+    pending.push_back({head, in_const});
+    if (ir.values[lhs].op == Opcode::Const && (ir.values[lhs].imm != 0) != is_and)
+    {
+      in_const = false;
+    }
+    block = rhs_block;
+  }
+
+  // Joins the path through the right operand with the one the left operand
+  // decided, which gets a block of its own since branch targets have no
+  // phis. Returns the 0/1 result.
+  ValueId join_rhs(NodeId id, ValueId lhs, ValueId rhs)
+  {
+    const FlatAst::Expr expr = ast.expr(id);
+    const bool is_and = expr.kind == ExprKind::And;
+    check_operands(bin_ops[static_cast<size_t>(expr.op())], type_of(lhs), type_of(rhs));
+    schedule(expr.rhs());
+    const ShortCircuit sc = pending.back();
+    pending.pop_back();
+    in_const = sc.in_const;
+
+    const BlockId rhs_end = open_block();
+    ValueId value = rhs;
+    if (type_of(rhs) != DataType::Bool)
+    {
+      value = ir.append(rhs_end, Opcode::Neq, DataType::Bool, rhs, ir.append(rhs_end, Opcode::Const, DataType::Int));
+    }
+    const BlockId decided = ir.add_block();
+    ir.set_succ(sc.head, is_and ? 1 : 0, decided);
+    const ValueId result = ir.append(decided, Opcode::Const, DataType::Bool, no_value, no_value, is_and ? 0 : 1);
+    block = ir.add_block();
+    ir.jump(rhs_end, block);
+    ir.jump(decided, block);
+    const ValueId args[] = {value, result};
+    return ir.add_phi(block, DataType::Bool, args);
+  }
+
+  // Lowers an if condition straight to branches. Short-circuit && and ||,
+  // and ! above them, become edges between the branches on their operands;
+  // anything else is lowered as a value and branched on.
+  Condition lower_condition(NodeId root)
+  {
+    number_subtree(root);
+    if (branches[root])
+    {
+      check_types(root);
+    }
+    std::vector<ExprFrame> frames = {{root, 0}};
+    std::vector<Condition> conditions;
+    while (!frames.empty())
+    {
+      const ExprFrame frame = frames.back();
+      frames.pop_back();
+      const FlatAst::Expr expr = ast.expr(frame.id);
+      if (expr.kind == ExprKind::Not && branches[frame.id])
+      {
+        // The operand is a bool, so the check in lower_unary() can't fail.
+        if (frame.visits == 0)
+        {
+          frames.push_back({frame.id, 1});
+          frames.push_back({expr.operand(), 0});
+        }
+        else
+        {
+          std::swap(conditions.back().on_true, conditions.back().on_false);
+        }
+      }
+      else if (short_circuits(frame.id))
+      {
+        const bool is_and = expr.kind == ExprKind::And;
+        if (frame.visits == 0)
+        {
+          frames.push_back({frame.id, 1});
+          frames.push_back({expr.lhs(), 0});
+        }
+        else if (frame.visits == 1)
+        {
+          // The edges that don't decide the result lead to the right operand.
+          std::vector<Edge> &undecided = is_and ? conditions.back().on_true : conditions.back().on_false;
+          block = ir.add_block();
+          connect(undecided, block);
+          undecided.clear();
+          frames.push_back({frame.id, 2});
+          frames.push_back({expr.rhs(), 0});
+        }
+        else
+        {
+          Condition rhs = std::move(conditions.back());
+          conditions.pop_back();
+          Condition &lhs = conditions.back();
+          check_operands(bin_ops[static_cast<size_t>(expr.op())], lhs.type, rhs.type);
+          merge_edges(lhs.on_true, rhs.on_true);
+          merge_edges(lhs.on_false, rhs.on_false);
+          lhs.type = DataType::Bool;
+        }
+      }
+      else
+      {
+        const ValueId value = lower_expr(frame.id);
+        const BlockId head = open_block();
+        ir.branch(head, value);
+        conditions.push_back({{{head, 0}}, {{head, 1}}, type_of(value)});
+      }
+    }
+    return std::move(conditions.back());
+  }
+
+  // Appends `from` to `into`, copying the shorter of the two.
+  static void merge_edges(std::vector<Edge> &into, std::vector<Edge> &from)
+  {
+    if (into.size() < from.size())
+    {
+      std::swap(into, from);
+    }
+    into.insert(into.end(), from.begin(), from.end());
+  }
+
+  void connect(const std::vector<Edge> &edges, BlockId target)
+  {
+    for (const Edge &edge : edges)
+    {
+      ir.set_succ(edge.from, edge.index, target);
+    }
+  }
+
+  // Whether the operator itself can fail at run time. Dividing by a
+  // non-zero literal can't: a literal is never negative.
+  bool can_fail(const FlatAst::Expr &expr) const
+  {
+    if (expr.kind == ExprKind::Div || expr.kind == ExprKind::Mod)
+    {
+      const FlatAst::Expr divisor = ast.expr(expr.rhs());
+      return divisor.kind != ExprKind::IntLit || divisor.literal() == 0;
+    }
+    return expr.kind <= ExprKind::Mod;
+  }
+
+  // Whether the node is an && or || whose right operand is only evaluated
+  // when the left one doesn't decide the result.
+  bool short_circuits(NodeId id) const
+  {
+    const FlatAst::Expr expr = ast.expr(id);
+    return (expr.kind == ExprKind::And || expr.kind == ExprKind::Or) && traps[expr.rhs()];
+  }
+
+  // Sethi-Ullman numbering of the subtree rooted at `root`: need[] is the
+  // number of registers a subtree takes to evaluate, and traps[] whether it
+  // contains arithmetic that can fail at run time. branches[] marks the
+  // subtrees that contain a short-circuit && or ||. Subtrees are stored in
+  // post-order, so one forward sweep over the subtree's range suffices.
+  void number_subtree(NodeId root)
+  {
+    if (node_values.size() < ast.expr_count())
+    {
+      node_values.resize(ast.expr_count());
+      need.resize(ast.expr_count());
+      traps.resize(ast.expr_count());
+      branches.resize(ast.expr_count());
+    }
+    for (NodeId id = ast.subtree_begin(root); id <= root; id++)
+    {
+      const FlatAst::Expr expr = ast.expr(id);
+      if (is_binary(expr.kind))
+      {
+        const uint32_t lhs = need[expr.lhs()];
+        const uint32_t rhs = need[expr.rhs()];
+        need[id] = lhs == rhs ? lhs + 1 : std::max(lhs, rhs);
+        traps[id] = traps[expr.lhs()] || traps[expr.rhs()] || can_fail(expr);
+        branches[id] = branches[expr.lhs()] || branches[expr.rhs()] || short_circuits(id);
+      }
+      else if (expr.kind == ExprKind::Negate || expr.kind == ExprKind::Not)
+      {
+        need[id] = std::max<uint32_t>(need[expr.operand()], 1);
+        traps[id] = traps[expr.operand()];
+        branches[id] = branches[expr.operand()];
+      }
+      else
+      {
+        // A variable is already held somewhere; a literal needs a register.
+        need[id] = expr.kind == ExprKind::Ident ? 0 : 1;
+        traps[id] = false;
+        branches[id] = false;
+      }
+    }
+  }
+
+  // Evaluates the operand that needs more registers first, which keeps
+  // fewer values live at once. Operands are only reordered when at most
+  // one of them can fail, so the error a program stops with is unchanged.
+  bool rhs_first(const FlatAst::Expr &expr) const
+  {
+    const bool fixed = bin_ops[static_cast<size_t>(expr.op())].rhs_first;
+    if (traps[expr.lhs()] && traps[expr.rhs()])
+      return fixed;
+    const uint32_t lhs = need[expr.lhs()];
+    const uint32_t rhs = need[expr.rhs()];
+    return lhs == rhs ? fixed : rhs > lhs;
+  }
+
+  // Rewrites the instructions just lowered for `root`, which are the last
+  // ones in their block, in Sethi-Ullman order. Every node but a variable
+  // has exactly one instruction, unless the subtree branches, and then it
+  // is left alone.
+  void schedule(NodeId root)
+  {
+    if (ast.expr(root).kind == ExprKind::Ident || branches[root])
+      return;
+    order.clear();
+    schedule_work.clear();
+    schedule_work.push_back({root, 0});
+    while (!schedule_work.empty())
+    {
+      const ExprFrame frame = schedule_work.back();
+      schedule_work.pop_back();
+      const FlatAst::Expr expr = ast.expr(frame.id);
+      if (frame.visits > 0 || expr.kind == ExprKind::IntLit || expr.kind == ExprKind::CharLit ||
+          expr.kind == ExprKind::BoolLit)
+      {
+        order.push_back(node_values[frame.id]);
+      }
+      else if (expr.kind == ExprKind::Negate || expr.kind == ExprKind::Not)
+      {
+        schedule_work.push_back({frame.id, 1});
+        schedule_work.push_back({expr.operand(), 0});
+      }
+      else if (is_binary(expr.kind))
+      {
+        schedule_work.push_back({frame.id, 1});
+        schedule_work.push_back({rhs_first(expr) ? expr.lhs() : expr.rhs(), 0});
+        schedule_work.push_back({rhs_first(expr) ? expr.rhs() : expr.lhs(), 0});
+      }
+    }
+    std::vector<ValueId> &insts = ir.blocks[ir.values[node_values[root]].block].insts;
+    std::copy(order.begin(), order.end(), insts.end() - order.size());
+  }
+
+  ValueId lower_leaf(const FlatAst::Expr &expr)
+  {
+    switch (expr.kind)
+    {
+    case ExprKind::IntLit:
+      return ir.append(open_block(), Opcode::Const, DataType::Int, no_value, no_value, expr.literal());
+    case ExprKind::CharLit:
+      return ir.append(open_block(), Opcode::Const, DataType::Char, no_value, no_value, expr.literal());
+    case ExprKind::BoolLit:
+      return ir.append(open_block(), Opcode::Const, DataType::Bool, no_value, no_value, expr.literal());
+    case ExprKind::Ident:
+      return current[find_var(expr.symbol()).index];
+    default:
+      std::cerr << "Unknown expression\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  DataType leaf_type(const FlatAst::Expr &expr)
+  {
+    switch (expr.kind)
+    {
+    case ExprKind::IntLit:
+      return DataType::Int;
+    case ExprKind::CharLit:
+      return DataType::Char;
+    case ExprKind::BoolLit:
+      return DataType::Bool;
+    case ExprKind::Ident:
+      return find_var(expr.symbol()).dtype;
+    default:
+      std::cerr << "Unknown expression\n";
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  const Var &find_var(SymbolId name)
+  {
+    const Var *var = symbols.lookup(name);
+    if (var == nullptr)
+    {
+      std::cerr << "Variable " << name_of(name) << " not declared" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    return *var;
+  }
+
+  ValueId lower_unary(ExprKind kind, ValueId operand)
+  {
+    const DataType type = unary_type(kind, type_of(operand));
+    return append_folded(kind == ExprKind::Negate ? Opcode::Neg : Opcode::Not, type, operand);
+  }
+
+  // The result type of a unary operator, after checking its operand.
+  static DataType unary_type(ExprKind kind, DataType operand)
+  {
+    if (kind == ExprKind::Negate)
+    {
+      if (operand != DataType::Int)
+      {
+        std::cerr << "Cannot use '-' on non integers\n";
+        exit(EXIT_FAILURE);
+      }
+      return DataType::Int;
+    }
+    if (operand != DataType::Int && operand != DataType::Bool)
+    {
+      std::cerr << "Cannot use '!' on non-integers or non-booleans\n";
+      exit(EXIT_FAILURE);
+    }
+    return DataType::Bool;
+  }
+
+  // Appends the instruction, or the constant it computes when its operands
+  // are constants. Folding that would fail at run time is not done; inside
+  // a const initialiser the failure is recorded in const_error, to be
+  // reported as a compile error.
+  ValueId append_folded(Opcode op, DataType type, ValueId a, ValueId b = no_value)
+  {
+    const Inst &lhs = ir.values[a];
+    if (lhs.op == Opcode::Const && (b == no_value || ir.values[b].op == Opcode::Const))
+    {
+      int64_t result;
+      const ConstFold::Result status = ConstFold::evaluate(op, lhs.imm, b == no_value ? 0 : ir.values[b].imm, result);
+      if (status == ConstFold::Result::Ok)
+        return ir.append(open_block(), Opcode::Const, type, no_value, no_value, result);
+      if (in_const && const_error == ConstFold::Result::Ok)
+      {
+        const_error = status;
+      }
+    }
+    return ir.append(open_block(), op, type, a, b);
+  }
+
+  void lower_scope(NodeId scope)
+  {
+    symbols.enter_scope();
+    for (NodeId stmt : ast.body(scope))
+    {
+      lower_stmt(stmt);
+    }
+    symbols.exit_scope();
+  }
+
+  // An elif is a nested If in the else branch, so it is lowered as an if
+  // inside the else block.
+  void lower_if(const FlatAst::Stmt &stmt_if)
+  {
+    Condition cond = lower_condition(stmt_if.cond());
+    const size_t mark = writes.size();
+    const auto outer_vars = static_cast<uint32_t>(current.size());
+
+    const BlockId then_block = ir.add_block();
+    connect(cond.on_true, then_block);
+    block = then_block;
+    lower_scope(stmt_if.then_scope());
+    const BlockId then_end = terminated ? no_block : block;
+    std::vector<Write> then_values = undo_writes(mark, outer_vars);
+
+    const BlockId else_block = ir.add_block();
+    connect(cond.on_false, else_block);
+    block = else_block;
+    terminated = false;
+    if (stmt_if.else_branch() != no_node)
+    {
+      const FlatAst::Stmt else_branch = ast.stmt(stmt_if.else_branch());
+      if (else_branch.kind == StmtKind::If)
+      {
+        lower_if(else_branch);
+      }
+      else
+      {
+        lower_scope(stmt_if.else_branch());
+      }
+    }
+    const BlockId else_end = terminated ? no_block : block;
+    std::vector<Write> else_values = undo_writes(mark, outer_vars);
+
+    block = ir.add_block();
+    terminated = false;
+    if (then_end == no_block || else_end == no_block)
+    {
+      // With at most one way in, the variables take that side's values.
+      if (then_end != no_block)
+      {
+        ir.jump(then_end, block);
+        rebind(then_values);
+      }
+      else if (else_end != no_block)
+      {
+        ir.jump(else_end, block);
+        rebind(else_values);
+      }
+      return;
+    }
+
+    ir.jump(then_end, block);
+    ir.jump(else_end, block);
+    const uint32_t in_else = ++stamp;
+    for (const Write &write : else_values)
+    {
+      seen[write.index] = in_else;
+      other[write.index] = write.value;
+    }
+    const uint32_t merged = ++stamp;
+    std::vector<Write> joined;
+    for (const Write &write : then_values)
+    {
+      const ValueId else_value = seen[write.index] == in_else ? other[write.index] : current[write.index];
+      seen[write.index] = merged;
+      joined.push_back({write.index, join(write.value, else_value)});
+    }
+    for (const Write &write : else_values)
+    {
+      if (seen[write.index] != merged)
+      {
+        joined.push_back({write.index, join(current[write.index], write.value)});
+      }
+    }
+    rebind(joined);
+  }
+
+  // The value of a variable after the two-way join at `block`. Only
+  // stack_top can hold values of different types; it is read as an int.
+  ValueId join(ValueId then_value, ValueId else_value)
+  {
+    if (then_value == else_value)
+      return then_value;
+    const ValueId args[] = {then_value, else_value};
+    const DataType type = type_of(then_value) == type_of(else_value) ? type_of(then_value) : DataType::Int;
+    return ir.add_phi(block, type, args);
+  }
+
+  // Pops the log back to `mark`, restoring the bindings from before, and
+  // returns the values the outer variables (indices below `outer_vars`) held
+  // before the undo, one entry per variable.
+  std::vector<Write> undo_writes(size_t mark, uint32_t outer_vars)
+  {
+    std::vector<Write> values;
+    stamp++;
+    for (size_t i = writes.size(); i-- > mark;)
+    {
+      const Write write = writes[i];
+      if (write.index < outer_vars && seen[write.index] != stamp)
+      {
+        seen[write.index] = stamp;
+        values.push_back({write.index, current[write.index]});
+      }
+      current[write.index] = write.value;
+    }
+    writes.resize(mark);
+    return values;
+  }
+
+  void rebind(const std::vector<Write> &values)
+  {
+    for (const Write &write : values)
+    {
+      assign(write.index, write.value);
+    }
+  }
+
+  void assign(uint32_t index, ValueId value)
+  {
+    writes.push_back({index, current[index]});
+    current[index] = value;
+  }
+
+  void lower_stmt(NodeId id)
+  {
+    const FlatAst::Stmt stmt = ast.stmt(id);
+    switch (stmt.kind)
+    {
+    case StmtKind::Exit:
+    {
+      const ValueId code = lower_expr(stmt.expr());
+      ir.append(open_block(), Opcode::Exit, DataType::Int, code);
+      terminated = true;
+      break;
+    }
+    case StmtKind::Print:
+    {
+      const ValueId value = lower_expr(stmt.expr());
+      ir.append(open_block(), Opcode::Print, type_of(value), value);
+      break;
+    }
+    case StmtKind::If:
+      lower_if(stmt);
+      break;
+    case StmtKind::Const:
+    case StmtKind::Let:
+    {
+      const SymbolId name = stmt.symbol();
+      if (symbols.declared_in_current_scope(name))
+      {
+        std::cerr << "Variable " << name_of(name) << " already declared" << std::endl;
+        exit(EXIT_FAILURE);
+      }
+      ValueId value;
+      if (stmt.expr() == no_node)
+      {
+        value = ir.append(open_block(), Opcode::Const, stmt.dtype);
+      }
+      else
+      {
+        in_const = stmt.kind == StmtKind::Const;
+        const_error = ConstFold::Result::Ok;
+        value = lower_expr(stmt.expr());
+        in_const = false;
+        const DataType expr_type = type_of(value);
+        if (expr_type != stmt.dtype)
+        {
+          std::cerr << "Error: Type mismatch for variable '" << name_of(name)
+                    << "'. Expected " << type_to_string(stmt.dtype)
+                    << " but got " << type_to_string(expr_type) << std::endl;
+          exit(EXIT_FAILURE);
+        }
+        if (const_error != ConstFold::Result::Ok)
+        {
+          std::cerr << "Error: " << (const_error == ConstFold::Result::DivZero ? "Divide by zero" : "Integer overflow")
+                    << " in constant '" << name_of(name) << "'" << std::endl;
+          exit(EXIT_FAILURE);
+        }
+      }
+      const auto index = static_cast<uint32_t>(current.size());
+      current.push_back(value);
+      seen.push_back(0);
+      other.push_back(no_value);
+      symbols.declare(name, Var{index, stmt.dtype, stmt.kind == StmtKind::Let});
+      assign(stack_top, value);
+      break;
+    }
+    case StmtKind::Assign:
+    {
+      const SymbolId name = stmt.symbol();
+      const Var *found = symbols.lookup(name);
+      if (found == nullptr)
+      {
+        std::cerr << "You need to declare the variable first";
+        exit(EXIT_FAILURE);
+      }
+      const Var existing_var = *found;
+      if (!existing_var.mut)
+      {
+        std::cerr << "Error: Cannot assign to immutable variable '"
+                  << name_of(name) << "'\n";
+        exit(EXIT_FAILURE);
+      }
+      const ValueId value = lower_expr(stmt.expr());
+      const DataType type = type_of(value);
+      if (type != existing_var.dtype)
+      {
+        std::cerr << "Error: Type mismatch in assignment to '"
+                  << name_of(name) << "'. Expected "
+                  << type_to_string(existing_var.dtype)
+                  << ", got " << type_to_string(type) << "\n";
+        exit(EXIT_FAILURE);
+      }
+      assign(existing_var.index, value);
+      assign(stack_top, value);
+      break;
+    }
+    case StmtKind::Scope:
+      lower_scope(id);
+      break;
+    }
+  }
+
+  DataType type_of(ValueId value) const
+  {
+    return ir.values[value].type;
+  }
+
+  std::string_view name_of(SymbolId ident) const
+  {
+    return interner.name(ident);
+  }
+
+  std::string type_to_string(DataType type) const
+  {
+    switch (type)
+    {
+    case DataType::Int:
+      return "int";
+    case DataType::Char:
+      return "char";
+    default:
+      return "unknown";
+    }
+  }
+
+  const FlatAst &ast;
+  const Interner &interner;
+  Ir ir;
+  BlockId block = no_block;
+  bool terminated = false; // the current block already ends in an exit
+  ScopedSymbolTable<Var> symbols;
+  std::vector<ValueId> current;  // value of each variable, by declaration index
+  std::vector<Write> writes;     // undo log of rebindings
+  std::vector<uint32_t> seen;    // per variable, the last stamp that visited it
+  std::vector<ValueId> other;    // per variable, scratch for joining the two sides of an if
+  uint32_t stamp = 0;
+  bool in_const = false; // lowering a const initialiser
+  ConstFold::Result const_error = ConstFold::Result::Ok;
+  // Scratch for lower_expr() and schedule(), kept to reuse its capacity.
+  std::vector<ExprFrame> work;
+  std::vector<ValueId> operands;
+  std::vector<ShortCircuit> pending;
+  std::vector<ExprFrame> schedule_work;
+  std::vector<ValueId> order;
+  std::vector<ValueId> node_values; // per expression node, its value
+  std::vector<uint32_t> need;       // per expression node, registers to evaluate it
+  std::vector<bool> traps;          // per expression node, whether it can fail at run time
+  std::vector<bool> branches;       // per expression node, whether it contains a short-circuit
+};
@@ -3,47 +3,229 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <optional>
+#include <string_view>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <chrono>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "./sourceFile.hpp"
 #include "./tokenization.hpp"
 #include "./parser.hpp"
+#include "./parallelParser.hpp"
+#include "./incrementalParser.hpp"
+#include "./astCache.hpp"
+#include "./flatAst.hpp"
+#include "./irBuilder.hpp"
+#include "./passManager.hpp"
+#include "./constFold.hpp"
+#include "./deadCode.hpp"
+#include "./partialEval.hpp"
+#include "./regAlloc.hpp"
+#include "./rangeAnalysis.hpp"
 #include "./generator.hpp"
 
-int main(int argc, char **argv)
+struct Options
 {
+    const char *input = nullptr;
+    bool pipeline = false; // lex on a separate thread, overlapping with parsing
+    bool stats = false;    // print compiler statistics to stderr
+    size_t jobs = 0;       // parse top-level statements on this many threads; 0 = off
+    bool watch = false;    // rebuild incrementally whenever the input changes
+    bool cache = false;    // reuse / write the parsed AST in <input>.astc
+    uint64_t peval = 0;    // run the program at compile time for at most this many steps; 0 = off
+};
 
-    if (argc != 2)
+static Options parse_options(int argc, char **argv)
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        std::string_view arg = argv[i];
+        if (arg == "--pipeline")
+        {
+            options.pipeline = true;
+        }
+        else if (arg == "--stats")
+        {
+            options.stats = true;
+        }
+        else if (arg == "--cache")
+        {
+            options.cache = true;
+        }
+        else if (arg == "--watch")
+        {
+            options.watch = true;
+        }
+        else if (arg == "--parallel")
+        {
+            options.jobs = std::max(1u, std::thread::hardware_concurrency());
+        }
+        else if (arg.starts_with("--parallel="))
+        {
+            options.jobs = std::strtoul(argv[i] + std::strlen("--parallel="), nullptr, 10);
+            if (options.jobs == 0)
+            {
+                options.input = nullptr;
+                break;
+            }
+        }
+        else if (arg == "--peval")
+        {
+            options.peval = 10'000'000;
+        }
+        else if (arg.starts_with("--peval="))
+        {
+            options.peval = std::strtoull(argv[i] + std::strlen("--peval="), nullptr, 10);
+            if (options.peval == 0)
+            {
+                options.input = nullptr;
+                break;
+            }
+        }
+        else if (options.input == nullptr && (arg == "-" || !arg.starts_with("--")))
+        {
+            options.input = argv[i];
+        }
+        else
+        {
+            options.input = nullptr;
+            break;
+        }
+    }
+    if (options.input == nullptr || (options.watch && std::string_view(options.input) == "-"))
     {
-        std::cout << "Wrong input format the input should be ./mycomiper <input file>";
-        return EXIT_FAILURE;
+        std::cout << "Wrong input format the input should be ./mycomiper [--pipeline] [--parallel[=N]] [--watch] [--cache] [--peval[=STEPS]] [--stats] <input file>";
+        std::exit(EXIT_FAILURE);
     }
+    return options;
+}
 
-    std::string contents;
+static void print_stats(const ArenaAllocator::Stats &arena, const FlatAst &ast)
+{
+    std::cerr << "arena: " << arena.bytes_used << " bytes used, "
+              << arena.bytes_wasted << " bytes wasted, "
+              << arena.bytes_reserved << " bytes reserved in "
+              << arena.blocks << " blocks\n";
+    std::cerr << "flat ast: " << ast.memory_bytes() << " bytes for "
+              << ast.expr_count() << " expressions and "
+              << ast.stmt_count() << " statements\n";
+}
 
+// Tokenises and parses the source into a flat AST.
+static FlatAst parse_source(const Options &options, std::string_view source, Interner &interner)
+{
+    // The pointer AST only lives until it has been flattened; the parser
+    // arenas are released before code generation starts.
+    Tokeniser tokeniser(source, interner);
+    FlatAst ast;
+    if (options.jobs > 0)
     {
-        std::ifstream file(argv[1]);
-        if (!file)
+        // Statement boundaries are found on the complete token vector, so
+        // the whole file is tokenised up front.
+        const std::vector<Token> all_tokens = tokeniser.tokenise();
+        ParallelParser parser(all_tokens, options.jobs);
+        NodeProg prog = parser.parse();
+        ast = Flattener().flatten(prog);
+        if (options.stats)
         {
-            std::cerr << "Error: could not open file " << argv[1] << std::endl;
-            return EXIT_FAILURE;
+            print_stats(parser.arena_stats(), ast);
         }
-
-        std::stringstream buffer;
-        buffer << file.rdbuf();
-        contents = buffer.str();
     }
+    else
+    {
+        // The parser pulls tokens from the tokeniser on demand, so only a
+        // small lookahead window of tokens is ever held in memory.
+        std::optional<PipelinedTokenSource> pipelined;
+        TokenSource *tokens = &tokeniser;
+        if (options.pipeline)
+        {
+            tokens = &pipelined.emplace(tokeniser);
+        }
 
-    // std::cout << "File contents:\n" << contents << std::endl;
-
-    Tokeniser tokeniser(std::move(contents));
-    std::vector<Token> tokens = tokeniser.tokenise();
-
-    Parser parser(std::move(tokens));
-
-    NodeProg prog = parser.parse();
+        Parser parser(*tokens);
+        NodeProg prog = parser.parse();
+        ast = Flattener().flatten(prog);
+        if (options.stats)
+        {
+            print_stats(parser.arena().stats(), ast);
+        }
+    }
+    return ast;
+}
 
-    Generator generator(std::move(prog));
-    std::string output = generator.gen_prog();
+// Lowers the program to the IR, optimises it, allocates registers,
+// generates assembly and assembles and links it into ./out. With --peval the
+// program is run at compile time first, and when it finishes the binary
+// just replays its output.
+static void emit(const Options &options, const FlatAst &ast, const Interner &interner)
+{
+    Ir ir = IrBuilder(ast, interner).build();
+    PassManager passes;
+    passes.add("constant-folding", ConstFold::fold_constants);
+    passes.add("unreachable-blocks", DeadCode::remove_unreachable_blocks);
+    passes.add("dead-values", DeadCode::remove_dead_values);
+    passes.run(ir);
+    if (options.stats)
+    {
+        std::cerr << "ir: " << ir.live_value_count() << " instructions in "
+                  << ir.live_block_count() << " blocks\n";
+        for (const PassManager::Pass &pass : passes.passes())
+        {
+            std::cerr << "pass " << pass.name << ": " << pass.changes << " changes\n";
+        }
+    }
 
-    // std::cout<<output<<std::endl;
+    std::string output;
+    PartialEvaluator evaluator(ir, options.peval);
+    if (options.peval > 0 && evaluator.run())
+    {
+        if (options.stats)
+        {
+            std::cerr << "peval: finished in " << evaluator.steps() << " steps, "
+                      << evaluator.output().size() << " bytes of output\n";
+        }
+        output = Generator::gen_precomputed(evaluator.output(), evaluator.exit_code());
+    }
+    else
+    {
+        if (options.stats && options.peval > 0)
+        {
+            std::cerr << "peval: gave up after " << evaluator.steps() << " steps\n";
+        }
+        RegAlloc regs(ir);
+        regs.run();
+        if (options.stats)
+        {
+            const RegAlloc::Stats &alloc = regs.stats();
+            std::cerr << "regalloc: " << alloc.in_registers << " values in registers, " << alloc.spilled
+                      << " spilled, " << alloc.frame_slots << " frame slots, "
+                      << alloc.immediates << " immediates\n";
+        }
+        RangeAnalysis ranges(ir);
+        ranges.run();
+        if (options.stats)
+        {
+            const RangeAnalysis::Stats &range = ranges.stats();
+            std::cerr << "range: " << range.checks_removed << " overflow checks removed, "
+                      << range.checks_kept << " kept\n";
+        }
+        Peephole peephole;
+        Generator generator(ir, regs, ranges);
+        output = generator.gen_prog(peephole);
+        if (options.stats)
+        {
+            for (const Peephole::Rule &rule : peephole.rules())
+            {
+                std::cerr << "peephole " << rule.name << ": " << rule.fired << " rewrites\n";
+            }
+        }
+    }
 
     {
         std::fstream file("out.asm", std::ios::out);
@@ -53,5 +235,109 @@ int main(int argc, char **argv)
     system("nasm -felf64 errors.asm -o errors.o");
     system("nasm -felf64 out.asm -o out.o");
     system("ld -o out out.o print.o errors.o");
+}
+
+// Rebuilds whenever the input file changes. The front end is kept between
+// builds and only re-lexes and re-parses the statements an edit touched.
+// Each build runs in a forked child, because compile errors end the process;
+// the parent applies the same update to its own state only after the child
+// succeeded, so the next edit is always diffed against the last good build.
+// A successful build thus re-lexes and re-parses the edited statements
+// twice, once in each process; that work still scales with the edit, not
+// with the file.
+static int watch(const Options &options)
+{
+    Interner interner;
+    IncrementalParser front(interner);
+    struct stat last{};
+    bool first = true;
+    while (true)
+    {
+        struct stat st{};
+        if (::stat(options.input, &st) != 0 ||
+            (!first && st.st_mtim.tv_sec == last.st_mtim.tv_sec &&
+             st.st_mtim.tv_nsec == last.st_mtim.tv_nsec && st.st_size == last.st_size))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        last = st;
+        first = false;
+
+        std::string contents(SourceFile(options.input).contents());
+        std::cout.flush();
+        const pid_t pid = ::fork();
+        if (pid == 0)
+        {
+            front.update(contents);
+            FlatAst ast = Flattener().flatten(front.program());
+            if (options.stats)
+            {
+                const IncrementalParser::Stats &work = front.stats();
+                std::cerr << "incremental: " << work.reparsed << " statements reparsed, "
+                          << work.reused << " reused, " << work.relexed_bytes << " bytes relexed\n";
+                print_stats(front.arena_stats(), ast);
+            }
+            emit(options, ast, interner);
+            std::exit(EXIT_SUCCESS);
+        }
+        int status = 0;
+        if (pid < 0 || ::waitpid(pid, &status, 0) < 0)
+        {
+            std::cerr << "Error: could not start a build\n";
+            return EXIT_FAILURE;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+        {
+            front.update(std::move(contents));
+            std::cerr << "Built " << options.input << "\n";
+        }
+        else
+        {
+            std::cerr << "Build of " << options.input << " failed\n";
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    const Options options = parse_options(argc, argv);
+    if (options.watch)
+    {
+        return watch(options);
+    }
+
+    // The mapping must outlive tokenisation and parsing: tokens are views
+    // into it. Identifier names are copied into the interner once each.
+    SourceFile source(options.input);
+
+    Interner interner;
+    const bool use_cache = options.cache && std::string_view(options.input) != "-";
+    const std::string cache_path = AstCache::path_for(options.input);
+    std::optional<FlatAst> cached;
+    if (use_cache)
+    {
+        cached = AstCache::load(cache_path, source.contents(), interner);
+    }
+    if (options.stats && use_cache)
+    {
+        std::cerr << "ast cache: " << (cached.has_value() ? "hit" : "miss") << "\n";
+    }
+
+    FlatAst ast;
+    if (cached.has_value())
+    {
+        ast = std::move(cached.value());
+    }
+    else
+    {
+        ast = parse_source(options, source.contents(), interner);
+        if (use_cache)
+        {
+            AstCache::store(cache_path, source.contents(), ast, interner);
+        }
+    }
+
+    emit(options, ast, interner);
     return EXIT_SUCCESS;
 }
\ No newline at end of file
@@ -0,0 +1,114 @@
+#pragma once
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include <vector>
+#include "./parser.hpp"
+
+// Parses a fully tokenised program on several threads. The token vector is
+// cut into one slice per job at top-level statement boundaries, each slice
+// is parsed by its own Parser (and so into its own arena), and the
+// statement lists are concatenated in source order.
+//
+// Because every slice starts at a statement boundary, a slice parses exactly
+// as the same tokens would in a single-threaded parse. A slice's parse error
+// is only reported after every worker has finished, and it is the error of
+// the earliest failing slice, which is the one a single-threaded parse
+// would have stopped at.
+class ParallelParser
+{
+public:
+  ParallelParser(std::span<const Token> tokens, size_t jobs)
+      : m_tokens(tokens), m_jobs(std::max<size_t>(jobs, 1)) {}
+
+  NodeProg parse()
+  {
+    const std::vector<size_t> cuts = split();
+    const size_t slices = cuts.size() - 1;
+    for (size_t i = 0; i < slices; i++)
+    {
+      m_sources.push_back(std::make_unique<SpanTokenSource>(m_tokens.subspan(cuts[i], cuts[i + 1] - cuts[i])));
+      m_parsers.push_back(std::make_unique<Parser>(*m_sources[i]));
+    }
+    m_progs.resize(slices);
+
+    // The calling thread takes the first slice itself.
+    std::vector<std::thread> workers;
+    for (size_t i = 1; i < slices; i++)
+    {
+      workers.emplace_back([this, i]
+                           { m_progs[i] = m_parsers[i]->try_parse(); });
+    }
+    m_progs[0] = m_parsers[0]->try_parse();
+    for (std::thread &worker : workers)
+    {
+      worker.join();
+    }
+    for (size_t i = 0; i < slices; i++)
+    {
+      if (!m_progs[i].has_value())
+      {
+        std::cerr << m_parsers[i]->error();
+        std::exit(EXIT_FAILURE);
+      }
+    }
+
+    size_t count = 0;
+    for (const std::optional<NodeProg> &part : m_progs)
+    {
+      count += part->stmts.size();
+    }
+    NodeProg prog{std::pmr::vector<NodeStmt *>(&m_arena)};
+    prog.stmts.reserve(count);
+    for (const std::optional<NodeProg> &part : m_progs)
+    {
+      prog.stmts.insert(prog.stmts.end(), part->stmts.begin(), part->stmts.end());
+    }
+    return prog;
+  }
+
+  // Combined statistics of all worker arenas and the arena holding the
+  // stitched statement list.
+  ArenaAllocator::Stats arena_stats() const
+  {
+    ArenaAllocator::Stats total = m_arena.stats();
+    for (const std::unique_ptr<Parser> &parser : m_parsers)
+    {
+      total += parser->arena().stats();
+    }
+    return total;
+  }
+
+private:
+  // Token offsets at which to cut the program, including 0 and the end.
+  // Each slice holds at least 1/jobs of the tokens, so there are at most
+  // `jobs` slices. If the braces do not balance, the rest is left to the
+  // last slice so the error is reported as in a single-threaded parse.
+  std::vector<size_t> split() const
+  {
+    std::vector<size_t> cuts{0};
+    const size_t target = m_tokens.size() / m_jobs;
+    StatementBoundaries boundaries;
+    for (size_t i = 0; i < m_tokens.size() && cuts.size() < m_jobs; i++)
+    {
+      if (boundaries.starts_statement(m_tokens[i].type) && i > 0 && i - cuts.back() >= target)
+      {
+        cuts.push_back(i);
+      }
+    }
+    if (cuts.back() != m_tokens.size() || cuts.size() == 1)
+    {
+      cuts.push_back(m_tokens.size());
+    }
+    return cuts;
+  }
+
+  std::span<const Token> m_tokens;
+  size_t m_jobs;
+  std::vector<std::unique_ptr<SpanTokenSource>> m_sources;
+  std::vector<std::unique_ptr<Parser>> m_parsers;
+  std::vector<std::optional<NodeProg>> m_progs;
+  ArenaAllocator m_arena;
+};
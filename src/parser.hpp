@@ -1,12 +1,18 @@
 #pragma once
 
+#include <array>
+#include <cstdint>
+#include <memory_resource>
 #include <vector>
 #include <iostream>
 #include <variant>
 #include <optional>
+#include <string>
+#include <unordered_map>
 #include "./arenaAllocator.hpp"
+#include "./tokenStream.hpp"
 
-enum class DataType
+enum class DataType : uint8_t
 {
   Int,
   Char,
@@ -19,77 +25,24 @@ enum class UnaryOp
   Not,
 };
 
-struct NodeExpr;
-
-struct NodeBinExprEq
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprNeq
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprLt
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprGt
+enum class BinOp : uint8_t
 {
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-
-struct NodeBinExprAnd
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Mod,
+  Eq,
+  Neq,
+  Lt,
+  Gt,
+  Lte,
+  Gte,
+  And,
+  Or,
 };
 
-struct NodeBinExprOr
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-
-struct NodeBinExprLte
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprGte
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprMod
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprAdd
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprSub
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-struct NodeBinExprDiv
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
-
-struct NodeBinExprMul
-{
-  NodeExpr *lhs;
-  NodeExpr *rhs;
-};
+struct NodeExpr;
 
 struct NodeTerm;
 
@@ -106,7 +59,7 @@ struct NodeTermLit
 
 struct NodeTermIdent
 {
-  Token ident;
+  SymbolId ident;
 };
 
 struct NodeTermParen
@@ -120,7 +73,9 @@ struct NodeTerm
 
 struct NodeBinExpr
 {
-  std::variant<NodeBinExprAdd *, NodeBinExprMul *, NodeBinExprSub *, NodeBinExprDiv *, NodeBinExprMod *, NodeBinExprEq *, NodeBinExprGt *, NodeBinExprNeq *, NodeBinExprLte *, NodeBinExprGte *, NodeBinExprLt *, NodeBinExprAnd *, NodeBinExprOr *> op;
+  BinOp op;
+  NodeExpr *lhs;
+  NodeExpr *rhs;
 };
 
 struct NodeExpr
@@ -135,19 +90,19 @@ struct NodeStmtExit
 
 struct NodeStmtConst
 {
-  Token ident;
+  SymbolId ident;
   DataType dtype;
   NodeExpr *expr;
 };
 
 struct NodeStmtAssign
 {
-  Token ident;
+  SymbolId ident;
   NodeExpr *expr;
 };
 struct NodeStmtLet
 {
-  Token ident;
+  SymbolId ident;
   DataType dtype;
   std::optional<NodeExpr *> expr;
 };
@@ -158,9 +113,11 @@ struct NodeStmtPrint
 {
   NodeExpr *expr;
 };
+// Child lists are std::pmr vectors whose storage comes from the parser's
+// arena, keeping a whole AST in the arena's blocks.
 struct NodeStmtScope
 {
-  std::vector<NodeStmt *> stmts;
+  std::pmr::vector<NodeStmt *> stmts;
 };
 
 struct NodeStmtIfCont;
@@ -193,264 +150,241 @@ struct NodeStmt
 
 struct NodeProg
 {
-  std::vector<NodeStmt *> stmts;
+  std::pmr::vector<NodeStmt *> stmts;
+};
+
+struct OperatorInfo
+{
+  int8_t prec = -1; // -1 for tokens that are not binary operators
+  BinOp op = BinOp::Add;
+};
+
+constexpr std::array<OperatorInfo, token_type_count> make_operator_table()
+{
+  std::array<OperatorInfo, token_type_count> table{};
+  auto set = [&table](TokenType type, int8_t prec, BinOp op)
+  {
+    table[static_cast<size_t>(type)] = {prec, op};
+  };
+  set(TokenType::or_, 0, BinOp::Or);   // ||
+  set(TokenType::and_, 1, BinOp::And); // &&
+
+  set(TokenType::eq, 2, BinOp::Eq); // ==, !=
+  set(TokenType::neq, 2, BinOp::Neq);
+
+  set(TokenType::lt, 3, BinOp::Lt); // <, >, <=, >=
+  set(TokenType::gt, 3, BinOp::Gt);
+  set(TokenType::lte, 3, BinOp::Lte);
+  set(TokenType::gte, 3, BinOp::Gte);
+
+  set(TokenType::plus, 4, BinOp::Add); // +, -
+  set(TokenType::sub, 4, BinOp::Sub);
+
+  set(TokenType::mul, 5, BinOp::Mul); // *, /, %
+  set(TokenType::div, 5, BinOp::Div);
+  set(TokenType::mod, 5, BinOp::Mod);
+  return table;
+}
+
+inline constexpr std::array<OperatorInfo, token_type_count> operator_table = make_operator_table();
+
+// Finds top-level statement boundaries in a token sequence without parsing
+// it. A statement ends with a ';' or '}' at brace depth zero, except that a
+// '}' followed by elif/else continues an if statement. Once the braces stop
+// balancing, no further boundaries are reported.
+class StatementBoundaries
+{
+public:
+  // Feeds the next token and reports whether it starts a new top-level
+  // statement. The first token fed always does.
+  bool starts_statement(TokenType type)
+  {
+    const bool starts = ended && !(after_close && (type == TokenType::elif || type == TokenType::else_));
+    if (type == TokenType::open_curly)
+    {
+      depth++;
+    }
+    else if (type == TokenType::close_curly)
+    {
+      depth--;
+    }
+    if (depth < 0)
+    {
+      broken = true;
+    }
+    ended = !broken && depth == 0 && (type == TokenType::semi || type == TokenType::close_curly);
+    after_close = type == TokenType::close_curly;
+    return starts;
+  }
+
+private:
+  int depth = 0;
+  bool ended = true;
+  bool after_close = false;
+  bool broken = false;
 };
 
+// Recursive descent parser over a TokenSource, allocating the AST in its own
+// arena. A syntax error unwinds to try_parse() as a ParseError, so callers
+// that parse on several threads can decide which error to report.
 class Parser
 {
 public:
-  explicit Parser(std::vector<Token> token_vec)
-      : tokens(std::move(token_vec)), allocator(1024 * 1024 * 4) {}
+  explicit Parser(TokenSource &source)
+      : tokens(source) {}
 
-  std::optional<NodeTerm *> parse_term(bool allow_unary = true)
+  // Literals and identifiers. Prefix operators and parentheses are handled
+  // by parse_expr().
+  std::optional<NodeTerm *> parse_term()
   {
     if (auto int_lit_token = try_consume(TokenType::int_lit))
     {
-      auto *node_term = allocator.alloc<NodeTerm>();
-      auto *node_lit = allocator.alloc<NodeTermLit>();
+      auto *node_term = allocator.emplace<NodeTerm>();
+      auto *node_lit = allocator.emplace<NodeTermLit>();
       node_lit->token = int_lit_token.value();
       node_term->val = node_lit;
       return node_term;
     }
     if (auto char_lit_token = try_consume(TokenType::char_lit))
     {
-      auto *node_term = allocator.alloc<NodeTerm>();
-      auto *node_lit = allocator.alloc<NodeTermLit>();
+      auto *node_term = allocator.emplace<NodeTerm>();
+      auto *node_lit = allocator.emplace<NodeTermLit>();
       node_lit->token = char_lit_token.value();
       node_term->val = node_lit;
       return node_term;
     }
     if (auto bool_lit_token = try_consume(TokenType::bool_lit))
     {
-      auto *node_term = allocator.alloc<NodeTerm>();
-      auto *node_lit = allocator.alloc<NodeTermLit>();
+      auto *node_term = allocator.emplace<NodeTerm>();
+      auto *node_lit = allocator.emplace<NodeTermLit>();
       node_lit->token = bool_lit_token.value();
       node_term->val = node_lit;
       return node_term;
     }
-    else if (auto minus_token = try_consume(TokenType::sub))
-    {
-      if (allow_unary == false)
-      {
-        std::cerr << "Expected term but got minus\n";
-        std::exit(EXIT_FAILURE);
-      }
-      auto operand = parse_term(false);
-      if (!operand.has_value())
-      {
-        std::cerr << "Expected term after unary minus\n";
-        std::exit(EXIT_FAILURE);
-      }
-      auto *node_unary = allocator.alloc<NodeTermUnary>();
-      node_unary->op = UnaryOp::Negate;
-      node_unary->operand = operand.value();
-
-      auto *node_term = allocator.alloc<NodeTerm>();
-      node_term->val = node_unary;
-      return node_term;
-    }
-    else if (auto not_token = try_consume(TokenType::not_))
-    {
-      if (allow_unary == false)
-      {
-        std::cerr << "Expected term but got minus\n";
-        std::exit(EXIT_FAILURE);
-      }
-      auto operand = parse_term(false);
-      if (!operand.has_value())
-      {
-        std::cerr << "Expected term after unary minus\n";
-        std::exit(EXIT_FAILURE);
-      }
-      auto *node_unary = allocator.alloc<NodeTermUnary>();
-      node_unary->op = UnaryOp::Not;
-      node_unary->operand = operand.value();
-
-      auto *node_term = allocator.alloc<NodeTerm>();
-      node_term->val = node_unary;
-      return node_term;
-    }
     else if (auto ident_token = try_consume(TokenType::ident))
     {
-      auto *node_term = allocator.alloc<NodeTerm>();
-      auto *node_ident = allocator.alloc<NodeTermIdent>();
-      node_ident->ident = ident_token.value();
+      auto *node_term = allocator.emplace<NodeTerm>();
+      auto *node_ident = allocator.emplace<NodeTermIdent>();
+      node_ident->ident = symbol_of(ident_token.value());
       node_term->val = node_ident;
       return node_term;
     }
-    else if (auto open_paren = try_consume(TokenType::open_paren))
-    {
-      auto node_expr = parse_expr();
-      if (node_expr.has_value())
-      {
-        if (auto close_paren = try_consume(TokenType::close_paren))
-        {
-          auto term_paren = allocator.alloc<NodeTermParen>();
-          term_paren->expr = node_expr.value();
-          auto node_term = allocator.alloc<NodeTerm>();
-          node_term->val = term_paren;
-          return node_term;
-        }
-        else
-        {
-          std::cerr << "Expected close parenthesis\n";
-          std::exit(EXIT_FAILURE);
-        }
-      }
-    }
 
     return std::nullopt;
   }
 
-  std::optional<NodeExpr *> parse_expr(int min_prec = 0, bool allow_unary = true)
+  // Precedence climbing over explicit operand and operator stacks, so long
+  // operator chains and deeply nested parentheses do not grow the native
+  // stack. Binary operators are left associative. A prefix '-' or '!' applies
+  // to a single term and is only allowed at the start of an expression or
+  // right after '('.
+  std::optional<NodeExpr *> parse_expr()
   {
-    std::optional<NodeTerm *> term_lhs = parse_term(allow_unary);
-    if (!term_lhs.has_value())
-    {
-      return std::nullopt;
-    }
-
-    auto expr_lhs = allocator.alloc<NodeExpr>();
-    expr_lhs->var = term_lhs.value();
+    operands.clear();
+    pending.clear();
+    ExprContext context = ExprContext::Start;
+    bool allow_unary = true;
 
     while (true)
     {
-      std::optional<Token> curr_tok = peek();
-      int prec;
-      if (curr_tok.has_value())
+      // Operand position: any number of '(' and at most one prefix operator
+      // before a term.
+      NodeTerm *term = nullptr;
+      while (term == nullptr)
       {
-        prec = get_precedence(curr_tok->type);
-        if (prec < min_prec)
+        if (auto node_term = parse_term())
         {
-          break;
+          term = node_term.value();
+        }
+        else if (auto unary_token = try_consume_unary())
+        {
+          if (allow_unary == false)
+          {
+            fail("Expected term but got minus\n");
+          }
+          const UnaryOp op = unary_token->type == TokenType::sub ? UnaryOp::Negate : UnaryOp::Not;
+          pending.push_back({PendingOp::Unary, op, BinOp::Add, 0});
+          allow_unary = false;
+          context = ExprContext::AfterUnary;
+        }
+        else if (try_consume(TokenType::open_paren))
+        {
+          pending.push_back({PendingOp::Paren, UnaryOp::Negate, BinOp::Add, 0});
+          allow_unary = true;
+        }
+        else
+        {
+          switch (context)
+          {
+          case ExprContext::Start:
+            return std::nullopt;
+          case ExprContext::AfterUnary:
+            fail("Expected term after unary minus\n");
+          case ExprContext::AfterBinary:
+            fail("Unable to parse expression\n");
+          }
         }
       }
-      else
-      {
-        std::cerr << "Expected semi\n";
-        std::exit(EXIT_FAILURE);
-      }
-      Token op = consume();
-      int next_min_prec = prec + 1;
-      auto expr_rhs = parse_expr(next_min_prec, false);
-      if (!expr_rhs.has_value())
-      {
-        std::cerr << "Unable to parse expression" << std::endl;
-        exit(EXIT_FAILURE);
-      }
-      auto bin_expr = allocator.alloc<NodeBinExpr>();
-      if (op.type == TokenType::plus)
-      {
-        auto bin_expr_add = allocator.alloc<NodeBinExprAdd>();
-        bin_expr_add->lhs = expr_lhs;
-        bin_expr_add->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_add;
-      }
-      else if (op.type == TokenType::mul)
-      {
-        auto bin_expr_mul = allocator.alloc<NodeBinExprMul>();
-        bin_expr_mul->lhs = expr_lhs;
-        bin_expr_mul->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_mul;
-      }
-      else if (op.type == TokenType::sub)
-      {
-        auto bin_expr_sub = allocator.alloc<NodeBinExprSub>();
-        bin_expr_sub->lhs = expr_lhs;
-        bin_expr_sub->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_sub;
-      }
-      else if (op.type == TokenType::div)
-      {
-        auto bin_expr_div = allocator.alloc<NodeBinExprDiv>();
-        bin_expr_div->lhs = expr_lhs;
-        bin_expr_div->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_div;
-      }
-      else if (op.type == TokenType::mod)
-      {
-        auto bin_expr_mod = allocator.alloc<NodeBinExprMod>();
-        bin_expr_mod->lhs = expr_lhs;
-        bin_expr_mod->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_mod;
-      }
-      else if (op.type == TokenType::eq)
-      {
-        auto bin_expr_eq = allocator.alloc<NodeBinExprEq>();
-        bin_expr_eq->lhs = expr_lhs;
-        bin_expr_eq->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_eq;
-      }
-      else if (op.type == TokenType::neq)
-      {
-        auto bin_expr_neq = allocator.alloc<NodeBinExprNeq>();
-        bin_expr_neq->lhs = expr_lhs;
-        bin_expr_neq->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_neq;
-      }
-      else if (op.type == TokenType::lt)
-      {
-        auto bin_expr_lt = allocator.alloc<NodeBinExprLt>();
-        bin_expr_lt->lhs = expr_lhs;
-        bin_expr_lt->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_lt;
-      }
-      else if (op.type == TokenType::gt)
-      {
-        auto bin_expr_gt = allocator.alloc<NodeBinExprGt>();
-        bin_expr_gt->lhs = expr_lhs;
-        bin_expr_gt->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_gt;
-      }
-      else if (op.type == TokenType::lte)
-      {
-        auto bin_expr_lte = allocator.alloc<NodeBinExprLte>();
-        bin_expr_lte->lhs = expr_lhs;
-        bin_expr_lte->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_lte;
-      }
-      else if (op.type == TokenType::gte)
-      {
-        auto bin_expr_gte = allocator.alloc<NodeBinExprGte>();
-        bin_expr_gte->lhs = expr_lhs;
-        bin_expr_gte->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_gte;
-      }
-      else if (op.type == TokenType::and_)
-      {
-        auto bin_expr_and = allocator.alloc<NodeBinExprAnd>();
-        bin_expr_and->lhs = expr_lhs;
-        bin_expr_and->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_and;
-      }
-      else if (op.type == TokenType::or_)
-      {
-        auto bin_expr_or = allocator.alloc<NodeBinExprOr>();
-        bin_expr_or->lhs = expr_lhs;
-        bin_expr_or->rhs = expr_rhs.value();
-        bin_expr->op = bin_expr_or;
-      }
-      else
+
+      // Operator position: close parentheses until a binary operator starts
+      // the next operand or the expression ends.
+      while (true)
       {
-        std::cerr << "Unexpected operation" << std::endl;
-        exit(EXIT_FAILURE);
-      }
+        while (!pending.empty() && pending.back().kind == PendingOp::Unary)
+        {
+          auto *node_unary = allocator.emplace<NodeTermUnary>();
+          node_unary->op = pending.back().unary;
+          node_unary->operand = term;
+          term = allocator.emplace<NodeTerm>();
+          term->val = node_unary;
+          pending.pop_back();
+        }
+        auto *node_expr = allocator.emplace<NodeExpr>();
+        node_expr->var = term;
+        operands.push_back(node_expr);
+
+        std::optional<Token> curr_tok = peek();
+        if (!curr_tok.has_value())
+        {
+          fail("Expected semi\n");
+        }
+        const OperatorInfo &info = operator_table[static_cast<size_t>(curr_tok->type)];
+        if (info.prec >= 0)
+        {
+          reduce_binary(info.prec);
+          pending.push_back({PendingOp::Binary, UnaryOp::Negate, info.op, info.prec});
+          consume();
+          allow_unary = false;
+          context = ExprContext::AfterBinary;
+          break;
+        }
 
-      auto new_expr = allocator.alloc<NodeExpr>();
-      new_expr->var = bin_expr;
-      expr_lhs = new_expr;
+        reduce_binary(0);
+        if (pending.empty())
+        {
+          return operands.back();
+        }
+        if (!try_consume(TokenType::close_paren))
+        {
+          fail("Expected close parenthesis\n");
+        }
+        pending.pop_back();
+        auto *term_paren = allocator.emplace<NodeTermParen>();
+        term_paren->expr = operands.back();
+        operands.pop_back();
+        term = allocator.emplace<NodeTerm>();
+        term->val = term_paren;
+      }
     }
-    return expr_lhs;
   }
 
   std::optional<NodeStmtScope *> parse_scope()
   {
     if (!try_consume(TokenType::open_curly))
     {
-      std::cerr << "Expected '{'\n";
-      std::exit(EXIT_FAILURE);
+      fail("Expected '{'\n");
     }
-    auto node_scope = allocator.alloc<NodeStmtScope>();
+    auto node_scope = allocator.emplace<NodeStmtScope>(std::pmr::vector<NodeStmt *>(&allocator));
     while (peek().has_value() && peek().value().type != TokenType::close_curly)
     {
       if (auto stmt = parse_stmt())
@@ -459,14 +393,12 @@ public:
       }
       else
       {
-        std::cerr << "Expected statement inside scope\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected statement inside scope\n");
       }
     }
     if (!try_consume(TokenType::close_curly))
     {
-      std::cerr << "Expected '}'\n";
-      std::exit(EXIT_FAILURE);
+      fail("Expected '}'\n");
     }
     return node_scope;
   }
@@ -477,53 +409,48 @@ public:
     {
       if (!try_consume(TokenType::open_paren))
       {
-        std::cerr << "Expected '('\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected '('\n");
       }
-      auto *node_elif = allocator.alloc<NodeStmtElif>();
+      auto *node_elif = allocator.emplace<NodeStmtElif>();
       if (auto node_expr = parse_expr())
       {
         node_elif->expr = node_expr.value();
         if (!try_consume(TokenType::close_paren))
         {
-          std::cerr << "Expected ')'\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected ')'\n");
         }
 
         if (auto node_scope = parse_scope())
         {
           node_elif->scope = node_scope.value();
           node_elif->cont = parse_if_cont();
-          auto node_cont = allocator.alloc<NodeStmtIfCont>();
+          auto node_cont = allocator.emplace<NodeStmtIfCont>();
           node_cont->clause = node_elif;
           return node_cont;
         }
         else
         {
-          std::cerr << "Expected scope\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected scope\n");
         }
       }
       else
       {
-        std::cerr << "Expected expression\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected expression\n");
       }
     }
     if (try_consume(TokenType::else_))
     {
-      auto node_else = allocator.alloc<NodeStmtElse>();
+      auto node_else = allocator.emplace<NodeStmtElse>();
       if (auto node_scope = parse_scope())
       {
         node_else->scope = node_scope.value();
-        auto node_cont = allocator.alloc<NodeStmtIfCont>();
+        auto node_cont = allocator.emplace<NodeStmtIfCont>();
         node_cont->clause = node_else;
         return node_cont;
       }
       else
       {
-        std::cerr << "Expected scope\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected scope\n");
       }
     }
     return std::nullopt;
@@ -534,8 +461,8 @@ public:
     if (peek().has_value() && peek()->type == TokenType::exit)
     {
       consume();
-      auto *node_stmt_exit = allocator.alloc<NodeStmtExit>();
-      auto *node_stmt = allocator.alloc<NodeStmt>();
+      auto *node_stmt_exit = allocator.emplace<NodeStmtExit>();
+      auto *node_stmt = allocator.emplace<NodeStmt>();
 
       if (auto node_expr = parse_expr())
       {
@@ -543,68 +470,60 @@ public:
         node_stmt->stmt = node_stmt_exit;
         if (!try_consume(TokenType::semi))
         {
-          std::cerr << "Expected semi\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected semi\n");
         }
         return node_stmt;
       }
       else
       {
-        std::cerr << "Expected Expression\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected Expression\n");
       }
     }
     else if (peek().has_value() && peek()->type == TokenType::print)
     {
       consume();
-      auto *node_stmt_print = allocator.alloc<NodeStmtPrint>();
-      auto *node_stmt = allocator.alloc<NodeStmt>();
+      auto *node_stmt_print = allocator.emplace<NodeStmtPrint>();
+      auto *node_stmt = allocator.emplace<NodeStmt>();
       if (auto node_expr = parse_expr())
       {
         node_stmt_print->expr = node_expr.value();
         node_stmt->stmt = node_stmt_print;
         if (!try_consume(TokenType::semi))
         {
-          std::cerr << "Expected semi\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected semi\n");
         }
         return node_stmt;
       }
       else
       {
-        std::cerr << "Expected Expression\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected Expression\n");
       }
     }
     else if (peek().has_value() && peek()->type == TokenType::cnst)
     {
       consume();
-      auto *node_stmt_const = allocator.alloc<NodeStmtConst>();
+      auto *node_stmt_const = allocator.emplace<NodeStmtConst>();
       if (!peek().has_value())
       {
-        std::cerr << "Expected type after const\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected type after const\n");
       }
       auto it = typeMappings.find(peek()->type);
       if (it == typeMappings.end())
       {
-        std::cerr << "Expected valid type after const\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected valid type after const\n");
       }
       DataType dtype = it->second;
       node_stmt_const->dtype = dtype;
       consume();
       if (!peek().has_value() || peek()->type != TokenType::ident)
       {
-        std::cerr << "Expected identifier after type\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected identifier after type\n");
       }
-      node_stmt_const->ident = consume();
-      auto *node_stmt = allocator.alloc<NodeStmt>();
+      node_stmt_const->ident = symbol_of(consume());
+      auto *node_stmt = allocator.emplace<NodeStmt>();
       if (!peek().has_value() || peek()->type != TokenType::assign)
       {
-        std::cerr << "Expected '=' after identifier\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected '=' after identifier\n");
       }
       consume();
       if (auto node_expr = parse_expr())
@@ -612,14 +531,12 @@ public:
         node_stmt_const->expr = node_expr.value();
         if (!try_consume(TokenType::semi))
         {
-          std::cerr << "Expected semi\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected semi\n");
         }
       }
       else
       {
-        std::cerr << "Expected Expression\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected Expression\n");
       }
 
       node_stmt->stmt = node_stmt_const;
@@ -628,28 +545,25 @@ public:
     else if (peek().has_value() && peek()->type == TokenType::let)
     {
       consume();
-      auto *node_stmt_let = allocator.alloc<NodeStmtLet>();
+      auto *node_stmt_let = allocator.emplace<NodeStmtLet>();
       if (!peek().has_value())
       {
-        std::cerr << "Expected type after const\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected type after const\n");
       }
       auto it = typeMappings.find(peek()->type);
       if (it == typeMappings.end())
       {
-        std::cerr << "Expected valid type after const\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected valid type after const\n");
       }
       DataType dtype = it->second;
       node_stmt_let->dtype = dtype;
       consume();
       if (!peek().has_value() || peek()->type != TokenType::ident)
       {
-        std::cerr << "Expected identifier after type\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected identifier after type\n");
       }
-      node_stmt_let->ident = consume();
-      auto *node_stmt = allocator.alloc<NodeStmt>();
+      node_stmt_let->ident = symbol_of(consume());
+      auto *node_stmt = allocator.emplace<NodeStmt>();
       // Optional assignment
       if (peek().has_value() && peek()->type == TokenType::assign)
       {
@@ -661,16 +575,14 @@ public:
         }
         else
         {
-          std::cerr << "Expected expression after '='\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected expression after '='\n");
         }
       }
 
       // Require semicolon in both cases
       if (!try_consume(TokenType::semi))
       {
-        std::cerr << "Expected ';' after let statement\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected ';' after let statement\n");
       }
 
       node_stmt->stmt = node_stmt_let;
@@ -678,13 +590,12 @@ public:
     }
     else if (peek().has_value() && peek()->type == TokenType::ident)
     {
-      auto *node_stmt_assign = allocator.alloc<NodeStmtAssign>();
-      node_stmt_assign->ident = consume();
+      auto *node_stmt_assign = allocator.emplace<NodeStmtAssign>();
+      node_stmt_assign->ident = symbol_of(consume());
 
       if (!peek().has_value() || peek()->type != TokenType::assign)
       {
-        std::cerr << "Expected '=' after identifier\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected '=' after identifier\n");
       }
       consume();
       if (auto node_expr = parse_expr())
@@ -692,16 +603,14 @@ public:
         node_stmt_assign->expr = node_expr.value();
         if (!try_consume(TokenType::semi))
         {
-          std::cerr << "Expected semi\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected semi\n");
         }
       }
       else
       {
-        std::cerr << "Expected Expression\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected Expression\n");
       }
-      auto *node_stmt = allocator.alloc<NodeStmt>();
+      auto *node_stmt = allocator.emplace<NodeStmt>();
       node_stmt->stmt = node_stmt_assign;
       return node_stmt;
     }
@@ -710,14 +619,13 @@ public:
       if (auto node_scope = parse_scope())
       {
 
-        auto node_stmt = allocator.alloc<NodeStmt>();
+        auto node_stmt = allocator.emplace<NodeStmt>();
         node_stmt->stmt = node_scope.value();
         return node_stmt;
       }
       else
       {
-        std::cerr << "Expected scope\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected scope\n");
       }
     }
     else if (peek().has_value() && peek()->type == TokenType::if_)
@@ -725,10 +633,9 @@ public:
       consume();
       if (!try_consume(TokenType::open_paren))
       {
-        std::cerr << "Expected '('\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected '('\n");
       }
-      auto *node_if = allocator.alloc<NodeStmtIf>();
+      auto *node_if = allocator.emplace<NodeStmtIf>();
 
       if (auto node_expr = parse_expr())
       {
@@ -736,28 +643,25 @@ public:
 
         if (!try_consume(TokenType::close_paren))
         {
-          std::cerr << "Expected ')'\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected ')'\n");
         }
 
         if (auto node_scope = parse_scope())
         {
           node_if->scope = node_scope.value();
           node_if->cont = parse_if_cont();
-          auto node_stmt = allocator.alloc<NodeStmt>();
+          auto node_stmt = allocator.emplace<NodeStmt>();
           node_stmt->stmt = node_if;
           return node_stmt;
         }
         else
         {
-          std::cerr << "Expected scope\n";
-          std::exit(EXIT_FAILURE);
+          fail("Expected scope\n");
         }
       }
       else
       {
-        std::cerr << "Expected expression\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected expression\n");
       }
     }
     return std::nullopt;
@@ -766,7 +670,7 @@ public:
   std::optional<NodeProg>
   parse_prog()
   {
-    NodeProg prog;
+    NodeProg prog{std::pmr::vector<NodeStmt *>(&allocator)};
 
     while (peek().has_value())
     {
@@ -777,40 +681,75 @@ public:
       }
       else
       {
-        std::cerr << "Expected statement\n";
-        std::exit(EXIT_FAILURE);
+        fail("Expected statement\n");
       }
     }
 
     return prog;
   }
 
-  NodeProg parse()
+  const ArenaAllocator &arena() const
   {
-    if (auto prog = parse_prog())
+    return allocator;
+  }
+
+  // Parses the whole program, or returns nothing on a syntax error and
+  // keeps its message for error().
+  std::optional<NodeProg> try_parse()
+  {
+    try
     {
-      return prog.value();
+      return parse_prog();
     }
-    else
+    catch (const ParseError &failure)
     {
-      std::cerr << "Expected Program\n";
+      error_message = failure.message;
+      return std::nullopt;
+    }
+  }
+
+  // Parses the whole program, ending the process on a syntax error.
+  NodeProg parse()
+  {
+    std::optional<NodeProg> prog = try_parse();
+    if (!prog.has_value())
+    {
+      std::cerr << error_message;
       std::exit(EXIT_FAILURE);
     }
+    return std::move(*prog);
+  }
+
+  // The message of the syntax error that made try_parse() fail.
+  const std::string &error() const
+  {
+    return error_message;
   }
 
 private:
+  struct ParseError
+  {
+    std::string message;
+  };
+
+  [[noreturn]] static void fail(const char *message)
+  {
+    throw ParseError{message};
+  }
+
   std::optional<Token> peek(int offset = 0)
   {
-    if (index + offset >= tokens.size())
-    {
-      return std::nullopt;
-    }
-    return tokens[index + offset];
+    return tokens.peek(offset);
   }
 
   Token consume()
   {
-    return tokens[index++];
+    return tokens.consume();
+  }
+
+  static SymbolId symbol_of(const Token &ident)
+  {
+    return static_cast<SymbolId>(ident.value);
   }
 
   std::optional<Token> try_consume(TokenType type)
@@ -822,44 +761,63 @@ private:
     return std::nullopt;
   }
 
-  int get_precedence(TokenType type)
+  std::optional<Token> try_consume_unary()
   {
-    auto it = precedence.find(type);
-    if (it != precedence.end())
+    if (auto t = peek(); t && (t->type == TokenType::sub || t->type == TokenType::not_))
     {
-      return it->second;
+      return consume();
     }
-    return -1;
+    return std::nullopt;
   }
 
-  std::unordered_map<TokenType, DataType> typeMappings = {
-      {TokenType::int_, DataType::Int},
-      {TokenType::char_, DataType::Char},
-      {TokenType::bool_, DataType::Bool},
+  // Builds nodes for the pending binary operators on top of the stack whose
+  // precedence is at least `min_prec`.
+  void reduce_binary(int min_prec)
+  {
+    while (!pending.empty() && pending.back().kind == PendingOp::Binary && pending.back().prec >= min_prec)
+    {
+      NodeExpr *rhs = operands.back();
+      operands.pop_back();
+      NodeExpr *lhs = operands.back();
+      auto *bin_expr = allocator.emplace<NodeBinExpr>(pending.back().binary, lhs, rhs);
+      auto *node_expr = allocator.emplace<NodeExpr>();
+      node_expr->var = bin_expr;
+      operands.back() = node_expr;
+      pending.pop_back();
+    }
+  }
 
+  enum class ExprContext : uint8_t
+  {
+    Start,
+    AfterUnary,
+    AfterBinary,
   };
 
-  std::unordered_map<TokenType, int> precedence = {
-      {TokenType::or_, 0},  // ||
-      {TokenType::and_, 1}, // &&
-
-      {TokenType::eq, 2}, // ==, !=
-      {TokenType::neq, 2},
-
-      {TokenType::lt, 3}, // <, >, <=, >=
-      {TokenType::gt, 3},
-      {TokenType::lte, 3},
-      {TokenType::gte, 3},
+  struct PendingOp
+  {
+    enum Kind : uint8_t
+    {
+      Paren,
+      Unary,
+      Binary,
+    } kind;
+    UnaryOp unary;
+    BinOp binary;
+    int8_t prec;
+  };
 
-      {TokenType::plus, 4}, // +, -
-      {TokenType::sub, 4},
+  std::unordered_map<TokenType, DataType> typeMappings = {
+      {TokenType::int_, DataType::Int},
+      {TokenType::char_, DataType::Char},
+      {TokenType::bool_, DataType::Bool},
 
-      {TokenType::mul, 5}, // *, /, %
-      {TokenType::div, 5},
-      {TokenType::mod, 5},
   };
 
-  std::vector<Token> tokens;
-  size_t index = 0;
+  // Scratch stacks for parse_expr(), kept to reuse their capacity.
+  std::vector<NodeExpr *> operands;
+  std::vector<PendingOp> pending;
+  std::string error_message;
+  TokenStream tokens;
   ArenaAllocator allocator;
 };
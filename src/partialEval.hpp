@@ -0,0 +1,146 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include "./ir.hpp"
+#include "./constFold.hpp"
+
+// Runs the whole program at compile time. Programs read no input, so unless
+// they exit with the process argument count, their output and exit code
+// are fixed; the binary then only has to write the one and return the
+// other.
+//
+// run() interprets the IR with a step budget of executed instructions and
+// gives up when the budget runs out, or on a division the CPU would fault
+// on (INT64_MIN / -1), which has no runtime check to reproduce.
+class PartialEvaluator
+{
+public:
+  PartialEvaluator(const Ir &program, uint64_t budget) : m_ir(program), m_budget(budget) {}
+
+  // Whether the program finished within the budget.
+  bool run()
+  {
+    std::vector<int64_t> values(m_ir.values.size(), 0);
+    // argc is unknown, but it only ever reaches phis and exits, so it is
+    // carried as a flag.
+    std::vector<bool> is_argc(m_ir.values.size(), false);
+    BlockId pred = no_block;
+    BlockId id = 0;
+    while (true)
+    {
+      const Block &block = m_ir.blocks[id];
+      if (pred != no_block)
+      {
+        // A phi's arguments are never phis of the same block, so the
+        // copies can be made one after another.
+        const size_t index = std::find(block.preds.begin(), block.preds.end(), pred) - block.preds.begin();
+        for (ValueId value : block.insts)
+        {
+          if (m_ir.values[value].op != Opcode::Phi)
+            break;
+          values[value] = values[m_ir.args(value)[index]];
+          is_argc[value] = is_argc[m_ir.args(value)[index]];
+        }
+      }
+      for (ValueId value : block.insts)
+      {
+        if (m_steps == m_budget)
+          return false;
+        m_steps++;
+        const Inst &inst = m_ir.values[value];
+        switch (inst.op)
+        {
+        case Opcode::Const:
+          values[value] = inst.imm;
+          break;
+        case Opcode::Argc:
+          is_argc[value] = true;
+          break;
+        case Opcode::Phi:
+          break;
+        case Opcode::Print:
+          if (inst.type == DataType::Char)
+          {
+            m_output += static_cast<char>(values[inst.a]);
+          }
+          else
+          {
+            m_output += std::to_string(values[inst.a]);
+          }
+          m_output += '\n';
+          break;
+        case Opcode::Jump:
+          pred = id;
+          id = block.succ[0];
+          break;
+        case Opcode::Branch:
+          pred = id;
+          id = block.succ[values[inst.a] != 0 ? 0 : 1];
+          break;
+        case Opcode::Exit:
+          m_output += '\n';
+          if (!is_argc[inst.a])
+          {
+            m_exit_code = values[inst.a];
+          }
+          return true;
+        default:
+        {
+          const int64_t b = inst.b == no_value ? 0 : values[inst.b];
+          switch (ConstFold::evaluate(inst.op, values[inst.a], b, values[value]))
+          {
+          case ConstFold::Result::Ok:
+            break;
+          case ConstFold::Result::Overflow:
+            if (inst.op == Opcode::Div || inst.op == Opcode::Mod)
+              return false;
+            runtime_error("Integer Overflow", 1);
+            return true;
+          case ConstFold::Result::DivZero:
+            runtime_error("Divide by Zero", 2);
+            return true;
+          }
+          break;
+        }
+        }
+      }
+    }
+  }
+
+  // Everything the program writes to stdout.
+  const std::string &output() const
+  {
+    return m_output;
+  }
+
+  // The exit code, or nothing when it is the process argument count.
+  std::optional<int64_t> exit_code() const
+  {
+    return m_exit_code;
+  }
+
+  uint64_t steps() const
+  {
+    return m_steps;
+  }
+
+private:
+  // Matches the handlers in errors.asm: print_string adds a newline of its
+  // own after the message.
+  void runtime_error(const char *message, int64_t code)
+  {
+    m_output += "Runtime Error: ";
+    m_output += message;
+    m_output += "\n\n";
+    m_exit_code = code;
+  }
+
+  const Ir &m_ir;
+  uint64_t m_budget;
+  uint64_t m_steps = 0;
+  std::string m_output;
+  std::optional<int64_t> m_exit_code;
+};
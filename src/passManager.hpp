@@ -0,0 +1,40 @@
+#pragma once
+#include <span>
+#include <vector>
+#include "./ir.hpp"
+
+// Runs a fixed sequence of IR passes. A pass returns how many changes it
+// made; the totals are kept per pass for --stats.
+class PassManager
+{
+public:
+  using Run = size_t (*)(Ir &ir);
+
+  struct Pass
+  {
+    const char *name;
+    Run run;
+    size_t changes = 0;
+  };
+
+  void add(const char *name, Run run)
+  {
+    m_passes.push_back({name, run});
+  }
+
+  void run(Ir &ir)
+  {
+    for (Pass &pass : m_passes)
+    {
+      pass.changes += pass.run(ir);
+    }
+  }
+
+  std::span<const Pass> passes() const
+  {
+    return m_passes;
+  }
+
+private:
+  std::vector<Pass> m_passes;
+};
@@ -0,0 +1,223 @@
+#pragma once
+#include <span>
+#include <vector>
+#include "./asm.hpp"
+
+// Peephole optimisation over the generated instruction list.
+//
+// The list is walked backwards, so the registers live after every
+// instruction are known when it is visited: rules can look at the current
+// instruction, the already optimised one after it, and whether a register
+// is still needed. A rule rewrites or drops them and returns whether it
+// fired; rules are tried until none fires. The counts are kept per rule for
+// --stats.
+class Peephole
+{
+public:
+  // The current instruction and the optimised code that follows it,
+  // reversed so the next instruction is at the back.
+  struct Window
+  {
+    AsmInst cur;
+    bool dropped;
+    std::vector<AsmInst> &rest;
+    std::vector<uint32_t> &live; // live after each instruction in `rest`
+
+    bool has_next() const
+    {
+      return !rest.empty();
+    }
+
+    AsmInst &next()
+    {
+      return rest.back();
+    }
+
+    uint32_t live_after_next() const
+    {
+      return live.back();
+    }
+
+    uint32_t live_after_cur() const
+    {
+      return rest.empty() ? 0 : live_before(rest.back(), live.back());
+    }
+
+    void drop_next()
+    {
+      rest.pop_back();
+      live.pop_back();
+    }
+  };
+
+  struct Rule
+  {
+    const char *name;
+    bool (*apply)(Window &window);
+    size_t fired = 0;
+  };
+
+  void run(std::vector<AsmInst> &code)
+  {
+    std::vector<AsmInst> rest;
+    std::vector<uint32_t> live;
+    rest.reserve(code.size());
+    live.reserve(code.size());
+    for (size_t i = code.size(); i-- > 0;)
+    {
+      Window window{code[i], false, rest, live};
+      bool changed = true;
+      while (changed && !window.dropped)
+      {
+        changed = false;
+        for (Rule &rule : m_rules)
+        {
+          if (rule.apply(window))
+          {
+            rule.fired++;
+            changed = true;
+            break;
+          }
+        }
+      }
+      if (!window.dropped)
+      {
+        const uint32_t live_after = window.live_after_cur();
+        rest.push_back(window.cur);
+        live.push_back(live_after);
+      }
+    }
+    code.assign(rest.rbegin(), rest.rend());
+  }
+
+  std::span<const Rule> rules() const
+  {
+    return m_rules;
+  }
+
+private:
+  // push X; pop X
+  static bool cancel_push_pop(Window &w)
+  {
+    if (w.cur.op != Mnemonic::Push || !w.has_next() || w.next().op != Mnemonic::Pop || !(w.next().dst == w.cur.dst))
+      return false;
+    w.drop_next();
+    w.dropped = true;
+    return true;
+  }
+
+  // push X; pop Y -> mov Y, X
+  static bool push_pop_to_mov(Window &w)
+  {
+    if (w.cur.op != Mnemonic::Push || !w.has_next() || w.next().op != Mnemonic::Pop ||
+        w.next().dst.kind != AsmOperand::Kind::Reg)
+      return false;
+    w.next() = {Mnemonic::Mov, w.next().dst, w.cur.dst};
+    w.dropped = true;
+    return true;
+  }
+
+  // mov r, r
+  static bool self_move(Window &w)
+  {
+    if (w.cur.op != Mnemonic::Mov || w.cur.dst.kind != AsmOperand::Kind::Reg || !(w.cur.dst == w.cur.src))
+      return false;
+    w.dropped = true;
+    return true;
+  }
+
+  // mov r, X; op Y, r -> op Y, X when r is not needed afterwards and op
+  // can encode X.
+  static bool forward(Window &w, bool immediate)
+  {
+    const AsmInst &cur = w.cur;
+    if (cur.op != Mnemonic::Mov || cur.dst.kind != AsmOperand::Kind::Reg || !w.has_next())
+      return false;
+    const AsmOperand value = cur.src;
+    if (immediate ? value.kind != AsmOperand::Kind::Imm
+                  : value.kind != AsmOperand::Kind::Reg && value.kind != AsmOperand::Kind::Slot)
+      return false;
+    const uint32_t reg = operand_regs(cur.dst);
+    if ((w.live_after_next() & reg) != 0)
+      return false;
+
+    AsmInst &next = w.next();
+    AsmOperand *use;
+    AsmOperand other;
+    switch (next.op)
+    {
+    case Mnemonic::Push:
+      use = &next.dst;
+      break;
+    case Mnemonic::Mov:
+    case Mnemonic::Add:
+    case Mnemonic::Sub:
+    case Mnemonic::Imul:
+    case Mnemonic::Cmp:
+    case Mnemonic::Test:
+      if ((operand_regs(next.dst) & reg) != 0)
+        return false;
+      use = &next.src;
+      other = next.dst;
+      break;
+    default:
+      return false;
+    }
+    if (!(*use == cur.dst))
+      return false;
+    // Only mov into a register takes a 64-bit immediate, and at most one
+    // operand may be in memory.
+    if (value.kind == AsmOperand::Kind::Imm && (value.value < INT32_MIN || value.value > INT32_MAX) &&
+        !(next.op == Mnemonic::Mov && other.kind == AsmOperand::Kind::Reg))
+      return false;
+    if (value.kind == AsmOperand::Kind::Slot && other.is_memory())
+      return false;
+    *use = value;
+    w.dropped = true;
+    return true;
+  }
+
+  static bool forward_immediate(Window &w)
+  {
+    return forward(w, true);
+  }
+
+  static bool forward_copy(Window &w)
+  {
+    return forward(w, false);
+  }
+
+  // movzx r, al; test r, r -> test al, al when r is not needed afterwards
+  static bool redundant_movzx(Window &w)
+  {
+    if (w.cur.op != Mnemonic::Movzx || !w.has_next() || w.next().op != Mnemonic::Test ||
+        !(w.next().dst == w.cur.dst) || !(w.next().src == w.cur.dst) ||
+        (w.live_after_next() & operand_regs(w.cur.dst)) != 0)
+      return false;
+    w.next().dst = w.cur.src;
+    w.next().src = w.cur.src;
+    w.dropped = true;
+    return true;
+  }
+
+  // A register write that nothing reads.
+  static bool dead_store(Window &w)
+  {
+    const Mnemonic op = w.cur.op;
+    if ((op != Mnemonic::Mov && op != Mnemonic::Movzx && op != Mnemonic::Lea) ||
+        w.cur.dst.kind != AsmOperand::Kind::Reg || (w.live_after_cur() & operand_regs(w.cur.dst)) != 0)
+      return false;
+    w.dropped = true;
+    return true;
+  }
+
+  Rule m_rules[7] = {
+      {"push-pop", cancel_push_pop},
+      {"push-pop-mov", push_pop_to_mov},
+      {"self-move", self_move},
+      {"immediate", forward_immediate},
+      {"copy", forward_copy},
+      {"movzx", redundant_movzx},
+      {"dead-store", dead_store},
+  };
+};
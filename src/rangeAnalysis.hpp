@@ -0,0 +1,412 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "./ir.hpp"
+
+// Bounds every integer value to an interval, to find the additions,
+// subtractions and multiplications that can never overflow and so need no
+// runtime check.
+//
+// The CFG is acyclic, so one walk of the dominator tree covers everything.
+// A value's range comes from its operands' ranges, a bool is 0 or 1, and a
+// phi takes the union of what its predecessors pass in. A block whose only
+// predecessor branches into it also knows the branch condition held (or
+// failed), and narrows the ranges of the compared values for itself and
+// the blocks it dominates; an undo log restores them on the way back up.
+class RangeAnalysis
+{
+public:
+  struct Range
+  {
+    int64_t lo = INT64_MIN;
+    int64_t hi = INT64_MAX;
+  };
+
+  struct Stats
+  {
+    size_t checks_removed = 0;
+    size_t checks_kept = 0;
+  };
+
+  explicit RangeAnalysis(const Ir &program) : m_ir(program) {}
+
+  void run()
+  {
+    const size_t block_count = m_ir.blocks.size();
+    m_ranges.assign(m_ir.values.size(), Range{});
+    m_phi_ranges.assign(m_ir.values.size(), empty);
+    m_unchecked.assign(m_ir.values.size(), false);
+
+    // Blocks come after their predecessors, so each block's immediate
+    // dominator is known by the time it is reached (Cooper, Harvey and
+    // Kennedy), and children are listed in block order.
+    std::vector<BlockId> idom(block_count, no_block);
+    std::vector<std::vector<BlockId>> children(block_count);
+    for (BlockId id = 1; id < block_count; id++)
+    {
+      for (BlockId pred : m_ir.blocks[id].preds)
+      {
+        if (pred != 0 && idom[pred] == no_block)
+          continue;
+        idom[id] = idom[id] == no_block ? pred : intersect(idom, idom[id], pred);
+      }
+      if (idom[id] != no_block)
+      {
+        children[idom[id]].push_back(id);
+      }
+    }
+
+    // A block is pushed once to enter it and once more to leave it.
+    std::vector<std::pair<BlockId, size_t>> work = {{0, SIZE_MAX}};
+    while (!work.empty())
+    {
+      const auto [id, mark] = work.back();
+      work.pop_back();
+      if (mark != SIZE_MAX)
+      {
+        undo(mark);
+        continue;
+      }
+      work.push_back({id, m_undo.size()});
+      narrow_from_branch(id);
+      visit(id);
+      for (auto child = children[id].rbegin(); child != children[id].rend(); child++)
+      {
+        work.push_back({*child, SIZE_MAX});
+      }
+    }
+  }
+
+  // Whether the arithmetic instruction can overflow.
+  bool needs_check(ValueId value) const
+  {
+    return !m_unchecked[value];
+  }
+
+  const Stats &stats() const
+  {
+    return m_stats;
+  }
+
+private:
+  static constexpr Range empty = {INT64_MAX, INT64_MIN};
+
+  struct Undo
+  {
+    ValueId value;
+    Range range;
+  };
+
+  static BlockId intersect(const std::vector<BlockId> &idom, BlockId a, BlockId b)
+  {
+    while (a != b)
+    {
+      while (a > b)
+      {
+        a = idom[a];
+      }
+      while (b > a)
+      {
+        b = idom[b];
+      }
+    }
+    return a;
+  }
+
+  // The range of [lo, hi], or nothing when it doesn't fit in 64 bits.
+  static bool fits(__int128 lo, __int128 hi, Range &range)
+  {
+    if (lo < INT64_MIN || hi > INT64_MAX)
+      return false;
+    range = {static_cast<int64_t>(lo), static_cast<int64_t>(hi)};
+    return true;
+  }
+
+  static Range clamp(__int128 lo, __int128 hi)
+  {
+    return {static_cast<int64_t>(std::max<__int128>(lo, INT64_MIN)),
+            static_cast<int64_t>(std::min<__int128>(hi, INT64_MAX))};
+  }
+
+  // The largest magnitude in the range, saturating at INT64_MAX.
+  static int64_t magnitude(Range range)
+  {
+    if (range.lo == INT64_MIN)
+      return INT64_MAX;
+    return std::max(range.hi < 0 ? -range.hi : range.hi, range.lo < 0 ? -range.lo : range.lo);
+  }
+
+  static Range type_range(DataType type)
+  {
+    switch (type)
+    {
+    case DataType::Bool:
+      return {0, 1};
+    case DataType::Char:
+      return {-128, 255};
+    default:
+      return {};
+    }
+  }
+
+  void visit(BlockId id)
+  {
+    const Block &block = m_ir.blocks[id];
+    for (ValueId value : block.insts)
+    {
+      const Inst &inst = m_ir.values[value];
+      Range range = type_range(inst.type);
+      switch (inst.op)
+      {
+      case Opcode::Const:
+        range = {inst.imm, inst.imm};
+        break;
+      case Opcode::Phi:
+        if (m_phi_ranges[value].lo <= m_phi_ranges[value].hi)
+        {
+          range = m_phi_ranges[value];
+        }
+        break;
+      case Opcode::Neg:
+      {
+        const Range a = m_ranges[inst.a];
+        if (a.lo != INT64_MIN)
+        {
+          range = {-a.hi, -a.lo};
+        }
+        break;
+      }
+      case Opcode::Add:
+      case Opcode::Sub:
+      case Opcode::Mul:
+        range = arithmetic(value);
+        break;
+      case Opcode::Div:
+      {
+        // |a / b| <= |a|, and INT64_MIN / 1 is itself.
+        const Range a = m_ranges[inst.a];
+        const int64_t bound = magnitude(a);
+        range = {a.lo == INT64_MIN ? INT64_MIN : -bound, bound};
+        break;
+      }
+      case Opcode::Mod:
+      {
+        // |a % b| < |b| and |a % b| <= |a|, with the sign of a.
+        const Range a = m_ranges[inst.a];
+        const int64_t bound = std::min(magnitude(a), magnitude(m_ranges[inst.b]));
+        range = {a.lo < 0 ? -bound : 0, a.hi > 0 ? bound : 0};
+        break;
+      }
+      default:
+        break;
+      }
+      m_ranges[value] = range;
+    }
+
+    // What this block passes to the phis of its successor.
+    for (BlockId succ : block.succ)
+    {
+      if (succ == no_block)
+        continue;
+      const Block &target = m_ir.blocks[succ];
+      for (size_t i = 0; i < target.preds.size(); i++)
+      {
+        if (target.preds[i] != id)
+          continue;
+        for (ValueId phi : target.insts)
+        {
+          if (m_ir.values[phi].op != Opcode::Phi)
+            break;
+          const Range arg = m_ranges[m_ir.args(phi)[i]];
+          Range &range = m_phi_ranges[phi];
+          range = {std::min(range.lo, arg.lo), std::max(range.hi, arg.hi)};
+        }
+      }
+    }
+  }
+
+  // The range of an add, sub or mul, and whether it needs its overflow
+  // check. After a check the result is known to fit.
+  Range arithmetic(ValueId value)
+  {
+    const Inst &inst = m_ir.values[value];
+    const Range a = m_ranges[inst.a];
+    const Range b = m_ranges[inst.b];
+    __int128 lo;
+    __int128 hi;
+    if (inst.op == Opcode::Add)
+    {
+      lo = __int128{a.lo} + b.lo;
+      hi = __int128{a.hi} + b.hi;
+    }
+    else if (inst.op == Opcode::Sub)
+    {
+      lo = __int128{a.lo} - b.hi;
+      hi = __int128{a.hi} - b.lo;
+    }
+    else
+    {
+      const __int128 products[] = {__int128{a.lo} * b.lo, __int128{a.lo} * b.hi, __int128{a.hi} * b.lo,
+                                   __int128{a.hi} * b.hi};
+      lo = *std::min_element(std::begin(products), std::end(products));
+      hi = *std::max_element(std::begin(products), std::end(products));
+    }
+    Range range;
+    if (fits(lo, hi, range))
+    {
+      m_unchecked[value] = true;
+      m_stats.checks_removed++;
+      return range;
+    }
+    m_stats.checks_kept++;
+    return clamp(lo, hi);
+  }
+
+  // When the block is entered only through a branch, narrows the ranges
+  // with what the branch tested.
+  void narrow_from_branch(BlockId id)
+  {
+    const Block &block = m_ir.blocks[id];
+    if (block.preds.size() != 1)
+      return;
+    const Block &pred = m_ir.blocks[block.preds[0]];
+    const Inst &branch = m_ir.values[m_ir.terminator(block.preds[0])];
+    if (branch.op != Opcode::Branch)
+      return;
+
+    std::vector<std::pair<ValueId, bool>> conditions = {{branch.a, pred.succ[0] == id}};
+    while (!conditions.empty())
+    {
+      const auto [cond, holds] = conditions.back();
+      conditions.pop_back();
+      const Inst &inst = m_ir.values[cond];
+      switch (inst.op)
+      {
+      case Opcode::Not:
+        conditions.push_back({inst.a, !holds});
+        break;
+      case Opcode::And:
+      case Opcode::Or:
+        // Both sides are known only when an && holds or an || fails.
+        if (holds == (inst.op == Opcode::And))
+        {
+          conditions.push_back({inst.a, holds});
+          conditions.push_back({inst.b, holds});
+        }
+        break;
+      case Opcode::Eq:
+      case Opcode::Neq:
+      case Opcode::Lt:
+      case Opcode::Gt:
+      case Opcode::Lte:
+      case Opcode::Gte:
+        narrow_compare(holds ? inst.op : negate(inst.op), inst.a, inst.b);
+        break;
+      default:
+      {
+        const Range range = m_ranges[cond];
+        if (!holds)
+        {
+          narrow(cond, {0, 0});
+        }
+        else if (range.lo == 0)
+        {
+          narrow(cond, {1, range.hi});
+        }
+        else if (range.hi == 0)
+        {
+          narrow(cond, {range.lo, -1});
+        }
+        break;
+      }
+      }
+    }
+  }
+
+  static Opcode negate(Opcode op)
+  {
+    switch (op)
+    {
+    case Opcode::Eq:
+      return Opcode::Neq;
+    case Opcode::Neq:
+      return Opcode::Eq;
+    case Opcode::Lt:
+      return Opcode::Gte;
+    case Opcode::Gt:
+      return Opcode::Lte;
+    case Opcode::Lte:
+      return Opcode::Gt;
+    default:
+      return Opcode::Lt;
+    }
+  }
+
+  // Narrows a and b given that `a op b` holds.
+  void narrow_compare(Opcode op, ValueId a, ValueId b)
+  {
+    const Range ra = m_ranges[a];
+    const Range rb = m_ranges[b];
+    switch (op)
+    {
+    case Opcode::Eq:
+      narrow(a, rb);
+      narrow(b, ra);
+      break;
+    case Opcode::Neq:
+      if (rb.lo == rb.hi)
+      {
+        narrow(a, clamp(__int128{ra.lo} + (ra.lo == rb.lo), __int128{ra.hi} - (ra.hi == rb.lo)));
+      }
+      if (ra.lo == ra.hi)
+      {
+        narrow(b, clamp(__int128{rb.lo} + (rb.lo == ra.lo), __int128{rb.hi} - (rb.hi == ra.lo)));
+      }
+      break;
+    case Opcode::Lt:
+    case Opcode::Lte:
+    {
+      const int64_t strict = op == Opcode::Lt ? 1 : 0;
+      narrow(a, clamp(INT64_MIN, __int128{rb.hi} - strict));
+      narrow(b, clamp(__int128{ra.lo} + strict, INT64_MAX));
+      break;
+    }
+    case Opcode::Gt:
+      narrow_compare(Opcode::Lt, b, a);
+      break;
+    default:
+      narrow_compare(Opcode::Lte, b, a);
+      break;
+    }
+  }
+
+  // Intersects the value's range with `range`, unless that leaves nothing:
+  // the block can't be reached then, and the range doesn't matter.
+  void narrow(ValueId value, Range range)
+  {
+    const Range old = m_ranges[value];
+    const Range narrowed = {std::max(old.lo, range.lo), std::min(old.hi, range.hi)};
+    if (narrowed.lo > narrowed.hi || (narrowed.lo == old.lo && narrowed.hi == old.hi))
+      return;
+    m_undo.push_back({value, old});
+    m_ranges[value] = narrowed;
+  }
+
+  void undo(size_t mark)
+  {
+    while (m_undo.size() > mark)
+    {
+      m_ranges[m_undo.back().value] = m_undo.back().range;
+      m_undo.pop_back();
+    }
+  }
+
+  const Ir &m_ir;
+  std::vector<Range> m_ranges;     // per value, at the point being visited
+  std::vector<Range> m_phi_ranges; // per phi, the union of its arguments so far
+  std::vector<bool> m_unchecked;   // per value, arithmetic that can't overflow
+  std::vector<Undo> m_undo;
+  Stats m_stats;
+};
@@ -0,0 +1,438 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "./ir.hpp"
+#include "./constDivisor.hpp"
+
+enum class Reg : uint8_t
+{
+  rax,
+  rbx,
+  rcx,
+  rdx,
+  rsi,
+  rdi,
+  rbp,
+  r8,
+  r9,
+  r10,
+  r11,
+  r12,
+  r13,
+  r14,
+  r15,
+  rsp, // never allocated
+};
+
+inline constexpr const char *reg_names[] = {"rax", "rbx", "rcx", "rdx", "rsi", "rdi", "rbp", "r8",
+                                            "r9", "r10", "r11", "r12", "r13", "r14", "r15", "rsp"};
+
+// Where a value lives for its whole lifetime.
+struct Location
+{
+  enum class Kind : uint8_t
+  {
+    None, // never read
+    Reg,
+    Slot, // spilled to the frame
+    Imm,  // a constant encoded into the instructions that read it
+  };
+
+  Kind kind = Kind::None;
+  uint32_t index = 0; // a Reg, or a frame slot
+};
+
+// Linear-scan register allocation over the IR (Poletto and Sarkar).
+//
+// Positions number the instructions in layout order. The CFG is acyclic and
+// blocks come after their predecessors, so a value is live from its
+// definition to its last use in that order; a phi is live from the end of
+// its first predecessor, where the first copy into it happens, and its
+// arguments are read at the end of the matching predecessors.
+//
+// Intervals are handed out the 14 registers other than rsp and rax (which
+// the emitter keeps as scratch). When none is free, whichever interval ends
+// last is spilled to a frame slot for its whole lifetime. Some instructions
+// clobber a register: a division writes rdx and a print passes its argument
+// in rdi (the print routines preserve everything else). Intervals that are
+// live across such an instruction, or whose value a division reads, never
+// get that register.
+//
+// Constants that fit in a sign-extended 32-bit immediate take no register
+// or slot at all, unless an instruction reading them can't encode one: a
+// divisor left to idiv, or an operand that is tested against zero.
+//
+// A comparison, !, && or || used only as the condition of the branch that
+// ends its block is fused into the branch: the emitter lowers it to
+// compares and conditional jumps, without a 0/1 value. Such a value gets
+// no location, and its operands are read at the branch.
+class RegAlloc
+{
+public:
+  struct Stats
+  {
+    size_t in_registers = 0;
+    size_t spilled = 0;
+    size_t immediates = 0;
+    uint32_t frame_slots = 0;
+  };
+
+  explicit RegAlloc(const Ir &program) : m_ir(program) {}
+
+  void run()
+  {
+    for (BlockId id = 0; id < m_ir.blocks.size(); id++)
+    {
+      if (!m_ir.blocks[id].removed)
+      {
+        m_order.push_back(id);
+      }
+    }
+    find_fused_conditions();
+    build_intervals();
+    scan_registers();
+    assign_slots();
+    find_live_across();
+  }
+
+  // Live blocks in layout order.
+  const std::vector<BlockId> &order() const
+  {
+    return m_order;
+  }
+
+  Location location(ValueId value) const
+  {
+    return m_locations[value];
+  }
+
+  // Whether the value is a condition lowered as part of a branch.
+  bool fused(ValueId value) const
+  {
+    return m_fused[value];
+  }
+
+  // The registers holding values still needed after the block's last
+  // instruction, as a mask of Reg bits. Values are live over one stretch
+  // of the layout, so this covers whatever the following blocks read.
+  uint32_t live_across(BlockId block) const
+  {
+    return m_live_across[block];
+  }
+
+  // Frame size in 8-byte slots.
+  uint32_t frame_size() const
+  {
+    return m_stats.frame_slots;
+  }
+
+  const Stats &stats() const
+  {
+    return m_stats;
+  }
+
+private:
+  struct Interval
+  {
+    uint32_t start;
+    uint32_t end;
+    ValueId value;
+  };
+
+  // Registers in the order they are tried. The ones with clobbers go last.
+  static constexpr Reg allocatable[] = {Reg::rbx, Reg::rsi, Reg::r8, Reg::r9, Reg::r10, Reg::r11, Reg::r12,
+                                        Reg::r13, Reg::r14, Reg::r15, Reg::rbp, Reg::rcx, Reg::rdi, Reg::rdx};
+
+  // Instruction k sits at position 2k, so the point just after a print can
+  // be told apart from the next instruction.
+  void build_intervals()
+  {
+    std::vector<uint32_t> start(m_ir.values.size(), 0);
+    std::vector<uint32_t> end(m_ir.values.size(), 0);
+    m_block_end.assign(m_ir.blocks.size(), 0);
+    std::vector<bool> needs_reg(m_ir.values.size(), false);
+    uint32_t pos = 0;
+    for (BlockId id : m_order)
+    {
+      for (ValueId value : m_ir.blocks[id].insts)
+      {
+        pos += 2;
+        start[value] = pos;
+        const Opcode op = m_ir.values[value].op;
+        if (op == Opcode::Phi || m_fused[value])
+          continue;
+        if (op == Opcode::Branch)
+        {
+          read_condition(value, pos, end, needs_reg);
+          continue;
+        }
+        m_ir.for_each_operand(value, [&end, pos](ValueId operand)
+                              { end[operand] = std::max(end[operand], pos); });
+        // A print clobbers rdi once it has read its operand; a division
+        // clobbers rdx before it reads its divisor.
+        if (op == Opcode::Print)
+        {
+          m_clobbers[static_cast<size_t>(Reg::rdi)].push_back(pos + 1);
+        }
+        else if (op == Opcode::Div || op == Opcode::Mod)
+        {
+          m_clobbers[static_cast<size_t>(Reg::rdx)].push_back(pos);
+          const ValueId divisor = m_ir.values[value].b;
+          if (m_ir.values[divisor].op != Opcode::Const ||
+              ConstDivisor::of(m_ir.values[divisor].imm).kind == ConstDivisor::Kind::None)
+          {
+            needs_reg[divisor] = true;
+          }
+        }
+        else if (op == Opcode::Not || op == Opcode::And || op == Opcode::Or)
+        {
+          m_ir.for_each_operand(value, [&needs_reg](ValueId operand)
+                                { needs_reg[operand] = true; });
+        }
+      }
+      m_block_end[id] = pos;
+    }
+    for (BlockId id : m_order)
+    {
+      const Block &block = m_ir.blocks[id];
+      for (ValueId value : block.insts)
+      {
+        if (m_ir.values[value].op != Opcode::Phi)
+          break;
+        const std::span<const ValueId> args = m_ir.args(value);
+        for (size_t i = 0; i < args.size(); i++)
+        {
+          const uint32_t edge = m_block_end[block.preds[i]];
+          start[value] = std::min(start[value], edge);
+          end[args[i]] = std::max(end[args[i]], edge);
+        }
+      }
+    }
+
+    m_locations.assign(m_ir.values.size(), Location{});
+    for (BlockId id : m_order)
+    {
+      for (ValueId value : m_ir.blocks[id].insts)
+      {
+        if (end[value] == 0)
+          continue;
+        const Inst &inst = m_ir.values[value];
+        if (inst.op == Opcode::Const && !needs_reg[value] && inst.imm >= INT32_MIN && inst.imm <= INT32_MAX)
+        {
+          m_locations[value] = {Location::Kind::Imm, 0};
+          m_stats.immediates++;
+          continue;
+        }
+        m_intervals.push_back({start[value], end[value], value});
+      }
+    }
+    std::sort(m_intervals.begin(), m_intervals.end(), [](const Interval &a, const Interval &b)
+              { return a.start < b.start; });
+  }
+
+  static bool is_condition(Opcode op)
+  {
+    return op == Opcode::Not || (op >= Opcode::Eq && op <= Opcode::Or);
+  }
+
+  // Fuses, from each branch's condition down, the conditions that are only
+  // used there and sit in the branch's block.
+  void find_fused_conditions()
+  {
+    std::vector<uint32_t> uses(m_ir.values.size(), 0);
+    for (BlockId id : m_order)
+    {
+      for (ValueId value : m_ir.blocks[id].insts)
+      {
+        m_ir.for_each_operand(value, [&uses](ValueId operand)
+                              { uses[operand]++; });
+      }
+    }
+    m_fused.assign(m_ir.values.size(), false);
+    std::vector<ValueId> work;
+    for (BlockId id : m_order)
+    {
+      const Inst &branch = m_ir.values[m_ir.terminator(id)];
+      if (branch.op != Opcode::Branch)
+        continue;
+      work.push_back(branch.a);
+      while (!work.empty())
+      {
+        const ValueId value = work.back();
+        work.pop_back();
+        const Inst &inst = m_ir.values[value];
+        if (!is_condition(inst.op) || uses[value] != 1 || inst.block != id)
+          continue;
+        m_fused[value] = true;
+        if (inst.op == Opcode::Not || inst.op == Opcode::And || inst.op == Opcode::Or)
+        {
+          m_ir.for_each_operand(value, [&work](ValueId operand)
+                                { work.push_back(operand); });
+        }
+      }
+    }
+  }
+
+  // Marks the values a branch at `pos` reads through its fused condition.
+  // Those tested against zero rather than compared need a register.
+  void read_condition(ValueId branch, uint32_t pos, std::vector<uint32_t> &end, std::vector<bool> &needs_reg) const
+  {
+    std::vector<std::pair<ValueId, bool>> work = {{m_ir.values[branch].a, true}};
+    while (!work.empty())
+    {
+      const auto [value, tested] = work.back();
+      work.pop_back();
+      if (!m_fused[value])
+      {
+        end[value] = std::max(end[value], pos);
+        needs_reg[value] = needs_reg[value] || tested;
+        continue;
+      }
+      const Opcode op = m_ir.values[value].op;
+      const bool compared = op != Opcode::Not && op != Opcode::And && op != Opcode::Or;
+      m_ir.for_each_operand(value, [&work, compared](ValueId operand)
+                            { work.push_back({operand, !compared}); });
+    }
+  }
+
+  // Whether the register is clobbered at a point p with start < p <= end.
+  bool conflicts(Reg reg, const Interval &interval) const
+  {
+    const std::vector<uint32_t> &points = m_clobbers[static_cast<size_t>(reg)];
+    const auto next = std::upper_bound(points.begin(), points.end(), interval.start);
+    return next != points.end() && *next <= interval.end;
+  }
+
+  void scan_registers()
+  {
+    std::vector<Interval> active;
+    uint32_t free_regs = 0;
+    for (Reg reg : allocatable)
+    {
+      free_regs |= 1u << static_cast<unsigned>(reg);
+    }
+
+    for (const Interval &interval : m_intervals)
+    {
+      std::erase_if(active, [&](const Interval &old)
+                    {
+                      if (old.end >= interval.start)
+                        return false;
+                      free_regs |= 1u << m_locations[old.value].index;
+                      return true; });
+
+      bool assigned = false;
+      for (Reg reg : allocatable)
+      {
+        if ((free_regs & (1u << static_cast<unsigned>(reg))) != 0 && !conflicts(reg, interval))
+        {
+          free_regs &= ~(1u << static_cast<unsigned>(reg));
+          m_locations[interval.value] = {Location::Kind::Reg, static_cast<uint32_t>(reg)};
+          active.push_back(interval);
+          assigned = true;
+          break;
+        }
+      }
+      if (assigned)
+        continue;
+
+      // Spill whichever usable interval ends last.
+      Interval *victim = nullptr;
+      for (Interval &old : active)
+      {
+        const Reg reg = static_cast<Reg>(m_locations[old.value].index);
+        if (!conflicts(reg, interval) && (victim == nullptr || old.end > victim->end))
+        {
+          victim = &old;
+        }
+      }
+      if (victim != nullptr && victim->end > interval.end)
+      {
+        m_locations[interval.value] = m_locations[victim->value];
+        m_spilled.push_back(*victim);
+        *victim = interval;
+      }
+      else
+      {
+        m_spilled.push_back(interval);
+      }
+    }
+  }
+
+  void find_live_across()
+  {
+    // A register's intervals never overlap, so sorted by start they are
+    // sorted by end too.
+    std::vector<Interval> by_reg[std::size(reg_names)];
+    for (const Interval &interval : m_intervals)
+    {
+      const Location loc = m_locations[interval.value];
+      if (loc.kind == Location::Kind::Reg)
+      {
+        by_reg[loc.index].push_back(interval);
+      }
+    }
+    m_live_across.assign(m_ir.blocks.size(), 0);
+    for (BlockId id : m_order)
+    {
+      const uint32_t pos = m_block_end[id];
+      for (size_t reg = 0; reg < std::size(by_reg); reg++)
+      {
+        const auto next = std::upper_bound(by_reg[reg].begin(), by_reg[reg].end(), pos, [](uint32_t p, const Interval &interval)
+                                           { return p < interval.start; });
+        if (next != by_reg[reg].begin() && std::prev(next)->end > pos)
+        {
+          m_live_across[id] |= 1u << reg;
+        }
+      }
+    }
+  }
+
+  // Spilled values share slots when their intervals do not overlap.
+  void assign_slots()
+  {
+    std::sort(m_spilled.begin(), m_spilled.end(), [](const Interval &a, const Interval &b)
+              { return a.start < b.start; });
+    std::vector<uint32_t> free_slots;
+    auto ends_later = [](const Interval &a, const Interval &b)
+    { return a.end > b.end; };
+    std::priority_queue<Interval, std::vector<Interval>, decltype(ends_later)> active(ends_later);
+    for (const Interval &interval : m_spilled)
+    {
+      while (!active.empty() && active.top().end < interval.start)
+      {
+        free_slots.push_back(m_locations[active.top().value].index);
+        active.pop();
+      }
+      uint32_t slot;
+      if (free_slots.empty())
+      {
+        slot = m_stats.frame_slots++;
+      }
+      else
+      {
+        slot = free_slots.back();
+        free_slots.pop_back();
+      }
+      m_locations[interval.value] = {Location::Kind::Slot, slot};
+      active.push(interval);
+    }
+    m_stats.spilled = m_spilled.size();
+    m_stats.in_registers = m_intervals.size() - m_spilled.size();
+  }
+
+  const Ir &m_ir;
+  std::vector<BlockId> m_order;
+  std::vector<Interval> m_intervals; // sorted by start
+  std::vector<uint32_t> m_clobbers[std::size(reg_names)];
+  std::vector<Interval> m_spilled;
+  std::vector<Location> m_locations;
+  std::vector<bool> m_fused;
+  std::vector<uint32_t> m_block_end;   // position of each block's last instruction
+  std::vector<uint32_t> m_live_across; // by block
+  Stats m_stats;
+};
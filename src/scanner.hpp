@@ -0,0 +1,264 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define SCANNER_X86 1
+#endif
+
+// Vectorised run scanning for the tokeniser. Each scanner takes [p, end) and
+// returns a pointer to the first byte that does not belong to the run (or the
+// terminator that was searched for), or `end`. The SSE2 versions process 16
+// bytes per step and are always available on x86-64; AVX2 versions process 32
+// bytes and are selected once at runtime when the CPU supports them. The
+// final partial block is always handled by the scalar loop, so no scanner
+// reads past `end`.
+namespace scan
+{
+  inline bool is_ident_byte(unsigned char c)
+  {
+    return static_cast<unsigned char>((c | 0x20) - 'a') < 26 || static_cast<unsigned char>(c - '0') < 10;
+  }
+
+  inline bool is_digit_byte(unsigned char c)
+  {
+    return static_cast<unsigned char>(c - '0') < 10;
+  }
+
+  inline bool is_space_byte(unsigned char c)
+  {
+    return c == ' ' || static_cast<unsigned char>(c - '\t') < 5;
+  }
+
+  template <bool (*Pred)(unsigned char)>
+  inline const char *scalar_run(const char *p, const char *end)
+  {
+    while (p < end && Pred(static_cast<unsigned char>(*p)))
+    {
+      p++;
+    }
+    return p;
+  }
+
+  inline const char *scalar_find_byte(const char *p, const char *end, char c)
+  {
+    while (p < end && *p != c)
+    {
+      p++;
+    }
+    return p;
+  }
+
+  inline const char *scalar_find_comment_end(const char *p, const char *end)
+  {
+    while (p + 1 < end && !(p[0] == '*' && p[1] == '/'))
+    {
+      p++;
+    }
+    return p + 1 < end ? p : end;
+  }
+
+#ifdef SCANNER_X86
+  // Unsigned "lo <= x <= hi" per byte, using a wrapping subtract and an
+  // unsigned min since SSE2 only has signed byte compares.
+  inline __m128i in_range_sse2(__m128i x, char lo, char hi)
+  {
+    __m128i shifted = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+    __m128i limit = _mm_set1_epi8(static_cast<char>(hi - lo));
+    return _mm_cmpeq_epi8(_mm_min_epu8(shifted, limit), shifted);
+  }
+
+  inline __m128i ident_mask_sse2(__m128i x)
+  {
+    __m128i lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+    return _mm_or_si128(in_range_sse2(lower, 'a', 'z'), in_range_sse2(x, '0', '9'));
+  }
+
+  inline __m128i digit_mask_sse2(__m128i x)
+  {
+    return in_range_sse2(x, '0', '9');
+  }
+
+  inline __m128i space_mask_sse2(__m128i x)
+  {
+    return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')), in_range_sse2(x, '\t', '\r'));
+  }
+
+  // Advances while every byte matches `Mask`; stops at the first block
+  // containing a non-matching byte.
+  template <__m128i (*Mask)(__m128i), bool (*Pred)(unsigned char)>
+  inline const char *run_sse2(const char *p, const char *end)
+  {
+    while (end - p >= 16)
+    {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      uint32_t miss = ~static_cast<uint32_t>(_mm_movemask_epi8(Mask(block))) & 0xFFFFu;
+      if (miss != 0)
+      {
+        return p + __builtin_ctz(miss);
+      }
+      p += 16;
+    }
+    return scalar_run<Pred>(p, end);
+  }
+
+  inline const char *find_byte_sse2(const char *p, const char *end, char c)
+  {
+    const __m128i needle = _mm_set1_epi8(c);
+    while (end - p >= 16)
+    {
+      __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      uint32_t hit = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle)));
+      if (hit != 0)
+      {
+        return p + __builtin_ctz(hit);
+      }
+      p += 16;
+    }
+    return scalar_find_byte(p, end, c);
+  }
+
+  // Finds "*/" by matching '*' in one block and '/' in the block shifted by
+  // one byte, so a terminator straddling two blocks is still found.
+  inline const char *find_comment_end_sse2(const char *p, const char *end)
+  {
+    const __m128i star = _mm_set1_epi8('*');
+    const __m128i slash = _mm_set1_epi8('/');
+    while (end - p >= 17)
+    {
+      __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+      __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+      __m128i both = _mm_and_si128(_mm_cmpeq_epi8(first, star), _mm_cmpeq_epi8(second, slash));
+      uint32_t hit = static_cast<uint32_t>(_mm_movemask_epi8(both));
+      if (hit != 0)
+      {
+        return p + __builtin_ctz(hit);
+      }
+      p += 16;
+    }
+    return scalar_find_comment_end(p, end);
+  }
+
+  __attribute__((target("avx2"))) inline __m256i in_range_avx2(__m256i x, char lo, char hi)
+  {
+    __m256i shifted = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+    __m256i limit = _mm256_set1_epi8(static_cast<char>(hi - lo));
+    return _mm256_cmpeq_epi8(_mm256_min_epu8(shifted, limit), shifted);
+  }
+
+  __attribute__((target("avx2"))) inline __m256i ident_mask_avx2(__m256i x)
+  {
+    __m256i lower = _mm256_or_si256(x, _mm256_set1_epi8(0x20));
+    return _mm256_or_si256(in_range_avx2(lower, 'a', 'z'), in_range_avx2(x, '0', '9'));
+  }
+
+  __attribute__((target("avx2"))) inline __m256i digit_mask_avx2(__m256i x)
+  {
+    return in_range_avx2(x, '0', '9');
+  }
+
+  __attribute__((target("avx2"))) inline __m256i space_mask_avx2(__m256i x)
+  {
+    return _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')), in_range_avx2(x, '\t', '\r'));
+  }
+
+  template <__m256i (*Mask)(__m256i), __m128i (*Mask128)(__m128i), bool (*Pred)(unsigned char)>
+  __attribute__((target("avx2"))) inline const char *run_avx2(const char *p, const char *end)
+  {
+    while (end - p >= 32)
+    {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      uint32_t miss = ~static_cast<uint32_t>(_mm256_movemask_epi8(Mask(block)));
+      if (miss != 0)
+      {
+        return p + __builtin_ctz(miss);
+      }
+      p += 32;
+    }
+    return run_sse2<Mask128, Pred>(p, end);
+  }
+
+  __attribute__((target("avx2"))) inline const char *find_byte_avx2(const char *p, const char *end, char c)
+  {
+    const __m256i needle = _mm256_set1_epi8(c);
+    while (end - p >= 32)
+    {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      uint32_t hit = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle)));
+      if (hit != 0)
+      {
+        return p + __builtin_ctz(hit);
+      }
+      p += 32;
+    }
+    return find_byte_sse2(p, end, c);
+  }
+
+  __attribute__((target("avx2"))) inline const char *find_comment_end_avx2(const char *p, const char *end)
+  {
+    const __m256i star = _mm256_set1_epi8('*');
+    const __m256i slash = _mm256_set1_epi8('/');
+    while (end - p >= 33)
+    {
+      __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+      __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+      __m256i both = _mm256_and_si256(_mm256_cmpeq_epi8(first, star), _mm256_cmpeq_epi8(second, slash));
+      uint32_t hit = static_cast<uint32_t>(_mm256_movemask_epi8(both));
+      if (hit != 0)
+      {
+        return p + __builtin_ctz(hit);
+      }
+      p += 32;
+    }
+    return find_comment_end_sse2(p, end);
+  }
+#endif
+
+  // Table of scanner entry points, filled in once for the running CPU.
+  struct Ops
+  {
+    const char *(*ident_end)(const char *, const char *);
+    const char *(*digits_end)(const char *, const char *);
+    const char *(*space_end)(const char *, const char *);
+    const char *(*find_byte)(const char *, const char *, char);
+    const char *(*comment_end)(const char *, const char *);
+  };
+
+  inline Ops select_ops()
+  {
+#ifdef SCANNER_X86
+    if (__builtin_cpu_supports("avx2"))
+    {
+      return {
+          run_avx2<ident_mask_avx2, ident_mask_sse2, is_ident_byte>,
+          run_avx2<digit_mask_avx2, digit_mask_sse2, is_digit_byte>,
+          run_avx2<space_mask_avx2, space_mask_sse2, is_space_byte>,
+          find_byte_avx2,
+          find_comment_end_avx2,
+      };
+    }
+    return {
+        run_sse2<ident_mask_sse2, is_ident_byte>,
+        run_sse2<digit_mask_sse2, is_digit_byte>,
+        run_sse2<space_mask_sse2, is_space_byte>,
+        find_byte_sse2,
+        find_comment_end_sse2,
+    };
+#else
+    return {
+        scalar_run<is_ident_byte>,
+        scalar_run<is_digit_byte>,
+        scalar_run<is_space_byte>,
+        scalar_find_byte,
+        scalar_find_comment_end,
+    };
+#endif
+  }
+
+  inline const Ops &ops()
+  {
+    static const Ops selected = select_ops();
+    return selected;
+  }
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <cerrno>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only view of an input file. Regular files are memory-mapped so the
+// tokeniser lexes straight out of the page cache; pipes, terminals and
+// stdin ("-") fall back to reading into an owned buffer.
+class SourceFile
+{
+public:
+  inline explicit SourceFile(const char *path)
+  {
+    const bool is_stdin = std::string_view(path) == "-";
+    int fd = is_stdin ? STDIN_FILENO : ::open(path, O_RDONLY);
+    if (fd < 0)
+    {
+      std::cerr << "Error: could not open file " << path << std::endl;
+      std::exit(EXIT_FAILURE);
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+      void *mapped = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (mapped != MAP_FAILED)
+      {
+        ::madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char *>(mapped);
+        m_size = st.st_size;
+        m_mapped = true;
+      }
+    }
+
+    if (!m_mapped)
+    {
+      read_all(fd, path);
+      m_data = m_buffer.data();
+      m_size = m_buffer.size();
+    }
+
+    if (!is_stdin)
+    {
+      ::close(fd);
+    }
+  }
+
+  inline SourceFile(const SourceFile &other) = delete;
+
+  inline SourceFile &operator=(const SourceFile &other) = delete;
+
+  inline ~SourceFile()
+  {
+    if (m_mapped)
+    {
+      ::munmap(const_cast<char *>(m_data), m_size);
+    }
+  }
+
+  inline std::string_view contents() const
+  {
+    return {m_data, m_size};
+  }
+
+private:
+  inline void read_all(int fd, const char *path)
+  {
+    char chunk[1 << 16];
+    while (true)
+    {
+      ssize_t n = ::read(fd, chunk, sizeof(chunk));
+      if (n == 0)
+      {
+        break;
+      }
+      if (n < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        std::cerr << "Error: could not read file " << path << std::endl;
+        std::exit(EXIT_FAILURE);
+      }
+      m_buffer.append(chunk, n);
+    }
+  }
+
+  const char *m_data = nullptr;
+  size_t m_size = 0;
+  bool m_mapped = false;
+  std::string m_buffer;
+};
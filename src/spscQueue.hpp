@@ -0,0 +1,59 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <new>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side owns one index and only reads the other's, so a push or
+// pop is a single acquire load plus a release store. The indices live on
+// separate cache lines to avoid false sharing between the two threads.
+template <typename T, size_t Capacity>
+class SpscQueue
+{
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  inline bool try_push(T &&value)
+  {
+    const size_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head_cache == Capacity)
+    {
+      m_head_cache = m_head.load(std::memory_order_acquire);
+      if (tail - m_head_cache == Capacity)
+      {
+        return false;
+      }
+    }
+    m_slots[tail & (Capacity - 1)] = std::move(value);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  inline bool try_pop(T &out)
+  {
+    const size_t head = m_head.load(std::memory_order_relaxed);
+    if (head == m_tail_cache)
+    {
+      m_tail_cache = m_tail.load(std::memory_order_acquire);
+      if (head == m_tail_cache)
+      {
+        return false;
+      }
+    }
+    out = std::move(m_slots[head & (Capacity - 1)]);
+    m_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+private:
+  static constexpr size_t cache_line = 64;
+
+  // Consumer side: its index and its cached copy of the producer's index.
+  alignas(cache_line) std::atomic<size_t> m_head{0};
+  size_t m_tail_cache = 0;
+  // Producer side.
+  alignas(cache_line) std::atomic<size_t> m_tail{0};
+  size_t m_head_cache = 0;
+  alignas(cache_line) std::array<T, Capacity> m_slots{};
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "./interner.hpp"
+
+// Block-scoped symbol table keyed by SymbolId.
+//
+// Every live binding sits on one stack (m_bindings) in declaration order, so
+// the bindings of the innermost scope are always a suffix of it and that
+// stack doubles as the undo log for scope exit. Each symbol additionally has
+// a "top" slot pointing at its innermost binding, and each binding links to
+// the binding it shadows. Declare, lookup, the same-scope redeclaration check
+// and popping a binding at scope exit are all O(1).
+template <typename T>
+class ScopedSymbolTable
+{
+public:
+  inline void enter_scope()
+  {
+    m_marks.push_back(m_bindings.size());
+  }
+
+  // Drops every binding made since the matching enter_scope(), restoring any
+  // outer bindings they shadowed. Returns how many bindings were dropped.
+  inline size_t exit_scope()
+  {
+    const size_t mark = m_marks.back();
+    m_marks.pop_back();
+    const size_t dropped = m_bindings.size() - mark;
+    while (m_bindings.size() > mark)
+    {
+      const Binding &binding = m_bindings.back();
+      m_top[binding.symbol] = binding.shadowed;
+      m_bindings.pop_back();
+    }
+    return dropped;
+  }
+
+  inline void declare(SymbolId symbol, T value)
+  {
+    if (symbol >= m_top.size())
+    {
+      m_top.resize(symbol + 1, none);
+    }
+    m_bindings.push_back({std::move(value), symbol, m_top[symbol], depth()});
+    m_top[symbol] = static_cast<uint32_t>(m_bindings.size() - 1);
+  }
+
+  inline T *lookup(SymbolId symbol)
+  {
+    if (symbol >= m_top.size() || m_top[symbol] == none)
+    {
+      return nullptr;
+    }
+    return &m_bindings[m_top[symbol]].value;
+  }
+
+  inline bool declared_in_current_scope(SymbolId symbol) const
+  {
+    return symbol < m_top.size() && m_top[symbol] != none && m_bindings[m_top[symbol]].depth == depth();
+  }
+
+private:
+  static constexpr uint32_t none = UINT32_MAX;
+
+  struct Binding
+  {
+    T value;
+    SymbolId symbol;
+    uint32_t shadowed; // index of the binding this one hides, or none
+    uint32_t depth;
+  };
+
+  inline uint32_t depth() const
+  {
+    return static_cast<uint32_t>(m_marks.size());
+  }
+
+  std::vector<Binding> m_bindings;
+  std::vector<uint32_t> m_top;
+  std::vector<size_t> m_marks;
+};
@@ -0,0 +1,160 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <span>
+#include <thread>
+#include "./spscQueue.hpp"
+#include "./tokenization.hpp"
+
+// Lookahead window over a TokenSource. Tokens are pulled from the source in
+// small batches into a fixed ring buffer, so the parser never holds more
+// than `capacity` tokens regardless of the size of the input.
+class TokenStream
+{
+public:
+  static constexpr size_t capacity = 64;
+
+  explicit TokenStream(TokenSource &token_source) : source(token_source) {}
+
+  std::optional<Token> peek(size_t offset = 0)
+  {
+    if (offset >= count && !refill(offset + 1))
+    {
+      return std::nullopt;
+    }
+    return buffer[(head + offset) & mask];
+  }
+
+  Token consume()
+  {
+    Token token = buffer[head];
+    head = (head + 1) & mask;
+    count--;
+    return token;
+  }
+
+private:
+  static_assert((capacity & (capacity - 1)) == 0, "capacity must be a power of two");
+  static constexpr size_t mask = capacity - 1;
+
+  // Tops the ring up with as many tokens as fit (in at most two contiguous
+  // runs) and reports whether at least `needed` tokens are now buffered.
+  bool refill(size_t needed)
+  {
+    while (count < needed && !exhausted)
+    {
+      size_t tail = (head + count) & mask;
+      size_t room = std::min(capacity - count, capacity - tail);
+      size_t got = source.fill(&buffer[tail], room);
+      if (got == 0)
+      {
+        exhausted = true;
+      }
+      count += got;
+    }
+    return count >= needed;
+  }
+
+  TokenSource &source;
+  std::array<Token, capacity> buffer{};
+  size_t head = 0;
+  size_t count = 0;
+  bool exhausted = false;
+};
+
+// Runs a Tokeniser on its own thread and hands its output to the parser in
+// fixed-size batches through a lock-free SPSC queue, so lexing overlaps with
+// parsing. A batch with count == 0 marks the end of input.
+class PipelinedTokenSource : public TokenSource
+{
+public:
+  static constexpr size_t batch_size = 512;
+
+  explicit PipelinedTokenSource(Tokeniser &tokeniser)
+      : queue(std::make_unique<Queue>()), worker([this, &tokeniser]
+                                                 { produce(tokeniser); }) {}
+
+  PipelinedTokenSource(const PipelinedTokenSource &other) = delete;
+
+  PipelinedTokenSource &operator=(const PipelinedTokenSource &other) = delete;
+
+  ~PipelinedTokenSource() override
+  {
+    worker.join();
+  }
+
+  size_t fill(Token *out, size_t max) override
+  {
+    if (position == current.count)
+    {
+      if (done)
+      {
+        return 0;
+      }
+      while (!queue->try_pop(current))
+      {
+        std::this_thread::yield();
+      }
+      position = 0;
+      if (current.count == 0)
+      {
+        done = true;
+        return 0;
+      }
+    }
+    size_t n = std::min(max, current.count - position);
+    std::copy_n(current.tokens.begin() + position, n, out);
+    position += n;
+    return n;
+  }
+
+private:
+  struct Batch
+  {
+    std::array<Token, batch_size> tokens;
+    size_t count = 0;
+  };
+  using Queue = SpscQueue<Batch, 16>;
+
+  void produce(Tokeniser &tokeniser)
+  {
+    Batch batch;
+    do
+    {
+      batch.count = tokeniser.fill(batch.tokens.data(), batch_size);
+      while (!queue->try_push(std::move(batch)))
+      {
+        std::this_thread::yield();
+      }
+    } while (batch.count != 0);
+  }
+
+  std::unique_ptr<Queue> queue;
+  Batch current;
+  size_t position = 0;
+  bool done = false;
+  std::thread worker;
+};
+
+// Serves an already materialised range of tokens, e.g. one slice of a token
+// vector handed to a parser worker.
+class SpanTokenSource : public TokenSource
+{
+public:
+  explicit SpanTokenSource(std::span<const Token> token_span) : tokens(token_span) {}
+
+  size_t fill(Token *out, size_t max) override
+  {
+    size_t n = std::min(max, tokens.size() - position);
+    std::copy_n(tokens.begin() + position, n, out);
+    position += n;
+    return n;
+  }
+
+private:
+  std::span<const Token> tokens;
+  size_t position = 0;
+};
@@ -1,10 +1,18 @@
 #pragma once
+#include <array>
+#include <charconv>
+#include <cstdint>
+#include <limits>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <stdexcept>
-#include <unordered_map>
+#include <type_traits>
+#include <vector>
+#include "./interner.hpp"
+#include "./scanner.hpp"
 
-enum class TokenType
+enum class TokenType : uint8_t
 {
   exit,
   int_lit,
@@ -45,112 +53,310 @@ enum class TokenType
 
 };
 
+inline constexpr size_t token_type_count = static_cast<size_t>(TokenType::not_) + 1;
+
+// A token is a small POD view into the source buffer owned by the Tokeniser.
+// Literal values are decoded once at lex time and stored in `value`
+// (integer value, character code, or 0/1 for booleans); for identifiers
+// `value` holds the interned SymbolId.
 struct Token
 {
   TokenType type;
-  std::optional<std::string> val;
-  Token(TokenType t, std::optional<std::string> v = std::nullopt)
-      : type(t), val(std::move(v)) {}
+  uint32_t offset = 0;
+  uint32_t length = 0;
+  int64_t value = 0;
+
+  std::string_view text(std::string_view src) const
+  {
+    return src.substr(offset, length);
+  }
+};
+
+static_assert(std::is_trivially_copyable_v<Token>);
+static_assert(sizeof(Token) <= 24);
+
+// Anything the parser can pull tokens from. fill() writes up to `max`
+// tokens to `out` and returns how many were produced; 0 means end of input.
+class TokenSource
+{
+public:
+  virtual ~TokenSource() = default;
+  virtual size_t fill(Token *out, size_t max) = 0;
+};
+
+// Character classes used to dispatch the lexer's main loop with a single
+// table load per token instead of a chain of <cctype> calls.
+enum class CharClass : uint8_t
+{
+  other,
+  space,
+  alpha,
+  digit,
+  quote,
+  slash,
+  op,
+};
+
+// Per-byte lexer table. For operator characters `single` is the token the
+// character forms on its own and `second`/`pair` describe the two-character
+// operator it may start (e.g. '<' followed by '=' forms lte).
+struct CharInfo
+{
+  CharClass cls = CharClass::other;
+  bool has_single = false;
+  TokenType single = TokenType::semi;
+  char second = 0;
+  TokenType pair = TokenType::semi;
+};
+
+constexpr std::array<CharInfo, 256> make_char_table()
+{
+  std::array<CharInfo, 256> table{};
+  for (int c = 'a'; c <= 'z'; c++)
+  {
+    table[c].cls = CharClass::alpha;
+    table[c - 'a' + 'A'].cls = CharClass::alpha;
+  }
+  for (int c = '0'; c <= '9'; c++)
+  {
+    table[c].cls = CharClass::digit;
+  }
+  for (unsigned char c : {' ', '\t', '\n', '\v', '\f', '\r'})
+  {
+    table[c].cls = CharClass::space;
+  }
+  table['\''].cls = CharClass::quote;
+  table['/'] = {CharClass::slash, true, TokenType::div};
+
+  auto single = [&](unsigned char c, TokenType type)
+  {
+    table[c].cls = CharClass::op;
+    table[c].has_single = true;
+    table[c].single = type;
+  };
+  auto pair = [&](unsigned char c, char second, TokenType type)
+  {
+    table[c].cls = CharClass::op;
+    table[c].second = second;
+    table[c].pair = type;
+  };
+  single(';', TokenType::semi);
+  single('=', TokenType::assign);
+  single('+', TokenType::plus);
+  single('*', TokenType::mul);
+  single('-', TokenType::sub);
+  single('<', TokenType::lt);
+  single('>', TokenType::gt);
+  single('%', TokenType::mod);
+  single('(', TokenType::open_paren);
+  single(')', TokenType::close_paren);
+  single('{', TokenType::open_curly);
+  single('}', TokenType::close_curly);
+  single('!', TokenType::not_);
+  pair('=', '=', TokenType::eq);
+  pair('!', '=', TokenType::neq);
+  pair('<', '=', TokenType::lte);
+  pair('>', '=', TokenType::gte);
+  pair('&', '&', TokenType::and_);
+  pair('|', '|', TokenType::or_);
+  return table;
+}
+
+inline constexpr std::array<CharInfo, 256> char_table = make_char_table();
+
+struct Keyword
+{
+  std::string_view text;
+  TokenType type;
 };
 
-class Tokeniser
+inline constexpr std::array<Keyword, 12> keywords = {{
+    {"exit", TokenType::exit},
+    {"const", TokenType::cnst},
+    {"print", TokenType::print},
+    {"if", TokenType::if_},
+    {"else", TokenType::else_},
+    {"elif", TokenType::elif},
+    {"int", TokenType::int_},
+    {"char", TokenType::char_},
+    {"bool", TokenType::bool_},
+    {"true", TokenType::true_},
+    {"false", TokenType::false_},
+    {"let", TokenType::let},
+}};
+
+// Perfect hash over the keyword set: the first byte, last byte and length of
+// a word are mixed with a multiplier found at compile time such that every
+// keyword lands in its own slot of a 16-entry table. Classifying an
+// identifier is then one multiply, one length compare and one memcmp.
+constexpr uint32_t keyword_hash(std::string_view word, uint32_t seed)
+{
+  uint32_t key = (static_cast<uint32_t>(static_cast<unsigned char>(word.front())) << 16) |
+                 (static_cast<uint32_t>(static_cast<unsigned char>(word.back())) << 8) |
+                 static_cast<uint32_t>(word.size());
+  return (key * seed) >> 28;
+}
+
+constexpr uint32_t find_keyword_seed()
+{
+  for (uint32_t seed = 0x9E3779B1u;; seed += 2)
+  {
+    bool used[16] = {};
+    bool ok = true;
+    for (const Keyword &kw : keywords)
+    {
+      uint32_t slot = keyword_hash(kw.text, seed);
+      if (used[slot])
+      {
+        ok = false;
+        break;
+      }
+      used[slot] = true;
+    }
+    if (ok)
+    {
+      return seed;
+    }
+  }
+}
+
+inline constexpr uint32_t keyword_seed = find_keyword_seed();
+
+constexpr std::array<int8_t, 16> make_keyword_slots()
+{
+  std::array<int8_t, 16> slots{};
+  for (int8_t &slot : slots)
+  {
+    slot = -1;
+  }
+  for (size_t i = 0; i < keywords.size(); i++)
+  {
+    slots[keyword_hash(keywords[i].text, keyword_seed)] = static_cast<int8_t>(i);
+  }
+  return slots;
+}
+
+inline constexpr std::array<int8_t, 16> keyword_slots = make_keyword_slots();
+
+constexpr std::optional<TokenType> lookup_keyword(std::string_view word)
+{
+  if (word.size() < 2 || word.size() > 5)
+  {
+    return std::nullopt;
+  }
+  int8_t slot = keyword_slots[keyword_hash(word, keyword_seed)];
+  if (slot < 0 || keywords[slot].text != word)
+  {
+    return std::nullopt;
+  }
+  return keywords[slot].type;
+}
+
+static_assert(lookup_keyword("elif") == TokenType::elif);
+static_assert(lookup_keyword("let") == TokenType::let);
+static_assert(!lookup_keyword("lets").has_value());
+
+class Tokeniser : public TokenSource
 {
 public:
-  explicit Tokeniser(std::string contents) : src(std::move(contents))
+  Tokeniser(std::string_view contents, Interner &symbols) : src(contents), interner(symbols)
+  {
+    if (src.size() > std::numeric_limits<uint32_t>::max())
+    {
+      std::cerr << "Source file too large\n";
+      std::exit(EXIT_FAILURE);
+    }
+  }
+
+  std::string_view source() const
+  {
+    return src;
+  }
+
+  // Continues lexing at `offset`, which must lie between two tokens.
+  void seek(size_t offset)
   {
+    index = offset;
   }
 
+  // Lexes the whole source into a token array. The parser normally pulls
+  // tokens on demand through next()/fill() instead.
   std::vector<Token> tokenise()
   {
     std::vector<Token> tokens;
-    std::string buf = "";
-
-    // Map for single-character tokens
-    const std::unordered_map<char, TokenType> singleCharTokens = {
-        {';', TokenType::semi},
-        {'=', TokenType::assign},
-        {'+', TokenType::plus},
-        {'*', TokenType::mul},
-        {'-', TokenType::sub},
-        {'/', TokenType::div},
-        {'<', TokenType::lt},
-        {'>', TokenType::gt},
-        {'%', TokenType::mod},
-        {'(', TokenType::open_paren},
-        {')', TokenType::close_paren},
-        {'{', TokenType::open_curly},
-        {'}', TokenType::close_curly},
-        {'!', TokenType::not_}};
-
-    const std::unordered_map<std::string, TokenType> doubleCharTokens = {
-        {"==", TokenType::eq},
-        {"!=", TokenType::neq},
-        {"<=", TokenType::lte},
-        {">=", TokenType::gte},
-        {"&&", TokenType::and_},
-        {"||", TokenType::or_}};
-
-    // Map for keywords
-    const std::unordered_map<std::string, TokenType> keywords = {
-        {"exit", TokenType::exit},
-        {"const", TokenType::cnst},
-        {"print", TokenType::print},
-        {"if", TokenType::if_},
-        {"else", TokenType::else_},
-        {"elif", TokenType::elif},
-        {"int", TokenType::int_},
-        {"char", TokenType::char_},
-        {"bool", TokenType::bool_},
-        {"true", TokenType::true_},
-        {"false", TokenType::false_},
-        {"let", TokenType::let}};
-
-    while (peek().has_value())
+    while (auto token = next())
+    {
+      tokens.push_back(token.value());
+    }
+    return tokens;
+  }
+
+  size_t fill(Token *out, size_t max) override
+  {
+    size_t count = 0;
+    while (count < max)
+    {
+      auto token = next();
+      if (!token.has_value())
+      {
+        break;
+      }
+      out[count++] = token.value();
+    }
+    return count;
+  }
+
+  // Lexes and returns the next token, skipping whitespace and comments, or
+  // std::nullopt at the end of the source.
+  std::optional<Token> next()
+  {
+    while (index < src.size())
     {
-      char c = peek().value();
+      char c = src[index];
+      const size_t start = index;
+      const CharInfo &info = char_table[static_cast<unsigned char>(c)];
 
-      if (std::isalpha(c))
+      switch (info.cls)
       {
-        buf.push_back(consume());
-        while (peek().has_value() && std::isalnum(peek().value()))
-        {
-          buf.push_back(consume());
-        }
+      case CharClass::alpha:
+      {
+        skip_to(scanner.ident_end(cursor() + 1, end()));
 
-        auto it = keywords.find(buf);
-        if (it != keywords.end())
+        if (auto keyword = lookup_keyword(src.substr(start, index - start)))
         {
           // Handle boolean literals
-          if (it->second == TokenType::true_ || it->second == TokenType::false_)
+          if (keyword == TokenType::true_ || keyword == TokenType::false_)
           {
-            tokens.emplace_back(TokenType::bool_lit, buf);
+            return make_token(TokenType::bool_lit, start, keyword == TokenType::true_);
           }
           else
           {
-            tokens.emplace_back(it->second);
+            return make_token(keyword.value(), start);
           }
         }
         else
         {
-          tokens.emplace_back(TokenType::ident, buf);
+          return make_token(TokenType::ident, start, interner.intern(src.substr(start, index - start)));
         }
-        buf.clear();
       }
-      else if (std::isdigit(c))
+      case CharClass::digit:
       {
-        buf.push_back(consume());
-        while (peek().has_value() && std::isdigit(peek().value()))
+        skip_to(scanner.digits_end(cursor() + 1, end()));
+        int64_t value = 0;
+        auto [ptr, ec] = std::from_chars(src.data() + start, src.data() + index, value);
+        if (ec == std::errc::result_out_of_range)
         {
-          buf.push_back(consume());
+          std::cerr << "Integer literal out of bounds\n";
+          std::exit(EXIT_FAILURE);
         }
-        tokens.emplace_back(TokenType::int_lit, buf);
-        buf.clear();
+        return make_token(TokenType::int_lit, start, value);
       }
-      else if (std::isspace(c))
+      case CharClass::space:
       {
-        consume();
+        skip_to(scanner.space_end(cursor() + 1, end()));
+        break;
       }
-      else if (c == '\'')
+      case CharClass::quote:
       {
         consume(); // consume opening '
 
@@ -212,54 +418,44 @@ public:
         }
 
         consume(); // consume closing '
-        buf = charValue;
-        tokens.emplace_back(TokenType::char_lit, buf);
-        buf.clear();
-        continue;
+        return make_token(TokenType::char_lit, start, charValue);
       }
-      else if (c == '/')
+      case CharClass::slash:
       {
         if (peek(1).has_value() && peek(1).value() == '/')
         {
-          while (peek().has_value() && peek().value() != '\n')
-          {
-            consume();
-          }
+          skip_to(scanner.find_byte(cursor() + 2, end(), '\n'));
         }
         else if (peek(1).has_value() && peek(1).value() == '*')
         {
-          consume();
-          consume();
-          while (peek().has_value() && peek().value() != '*' && peek(1).has_value() && peek(1).value() != '/')
+          const char *terminator = scanner.comment_end(cursor() + 2, end());
+          if (terminator == end())
           {
-            consume();
+            std::cerr << "Unterminated block comment\n";
+            std::exit(EXIT_FAILURE);
           }
+          skip_to(terminator + 2);
+        }
+        else
+        {
           consume();
-          consume();
+          return make_token(TokenType::div, start);
         }
+        break;
       }
-      else
+      case CharClass::op:
       {
         // Check for two-character operators first
-        if (peek(1).has_value())
+        if (info.second != 0 && peek(1).has_value() && peek(1).value() == info.second)
         {
-          std::string twoCharOp = {peek().value(), peek(1).value()};
-          auto it2 = doubleCharTokens.find(twoCharOp);
-          if (it2 != doubleCharTokens.end())
-          {
-            tokens.emplace_back(it2->second);
-            consume();
-            consume();
-            continue;
-          }
+          consume();
+          consume();
+          return make_token(info.pair, start);
         }
-
-        // Then fallback to single-char tokens
-        auto it = singleCharTokens.find(c);
-        if (it != singleCharTokens.end())
+        else if (info.has_single)
         {
-          tokens.emplace_back(it->second);
           consume();
+          return make_token(info.single, start);
         }
         else
         {
@@ -267,9 +463,13 @@ public:
           std::exit(EXIT_FAILURE);
         }
       }
+      default:
+        std::cerr << "Wrong input: unknown character '" << c << "'\n";
+        std::exit(EXIT_FAILURE);
+      }
     }
 
-    return tokens;
+    return std::nullopt;
   }
 
   std::optional<char> peek(int offset = 0)
@@ -289,6 +489,28 @@ public:
     return src[index++];
   }
 
-  const std::string src;
+  const char *cursor() const
+  {
+    return src.data() + index;
+  }
+
+  const char *end() const
+  {
+    return src.data() + src.size();
+  }
+
+  void skip_to(const char *pos)
+  {
+    index = pos - src.data();
+  }
+
+  Token make_token(TokenType type, size_t start, int64_t value = 0) const
+  {
+    return Token{type, static_cast<uint32_t>(start), static_cast<uint32_t>(index - start), value};
+  }
+
+  const std::string_view src;
+  Interner &interner;
   size_t index = 0;
+  const scan::Ops &scanner = scan::ops();
 };
\ No newline at end of file